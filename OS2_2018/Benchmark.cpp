@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include "Benchmark.h"
+#include "TestUtils.h"
+#include "part.h"
+
+static double getMeanMicroseconds(const LatencyHistogram &histogram) {
+    return histogram.count ? (double) histogram.totalMicroseconds / histogram.count : 0;
+}
+
+Benchmark::Benchmark(Partition &partition_) : partition(partition_) {
+}
+
+BenchmarkResult Benchmark::run(const WorkloadGenerator &workload, const BenchmarkConfig &config) {
+    BenchmarkResult result;
+    result.workload = workload.getName();
+    result.config = config;
+    result.seconds = 0;
+    result.accesses = 0;
+    result.hits = 0;
+    result.stats = SystemStats();
+    PageNum memoryShare = std::max(config.memorySize / std::max(config.processCount, 1U), (PageNum) 1);
+    PageNum segmentSize = (PageNum) (memoryShare * config.overcommit);
+    if (!config.processCount || (config.processCount * SIZE_OF_PMT_IN_PAGES > config.pmtSpaceSize)
+        || !segmentSize || (segmentSize >= PMT_SIZE)) {
+        return result;
+    }
+
+    char *vmSpace = new char[(config.memorySize + 2) * PAGE_SIZE];
+    char *pmtSpace = new char[(config.pmtSpaceSize + 2) * PAGE_SIZE];
+    {
+        System system(alignToPage(vmSpace), config.memorySize, alignToPage(pmtSpace), config.pmtSpaceSize, &partition);
+        std::vector<Process *> processes;
+        std::vector<WorkloadGenerator *> generators;
+        for (unsigned i = 0; i < config.processCount; i++) {
+            processes.push_back(system.createProcess());
+            processes.back()->createSegment(PAGE_SIZE, segmentSize, READ_WRITE);
+            generators.push_back(workload.create(segmentSize, memoryShare, i + 1));
+        }
+
+        std::atomic<bool> done(false);
+        std::thread ticker([&system, &done]() {
+            while (!done) {
+                std::this_thread::sleep_for(std::chrono::microseconds(system.periodicJob()));
+            }
+        });
+
+        // the processes only start once all of them are there, otherwise the first ones may be
+        // done before the last ones begin and never compete for memory
+        std::atomic<bool> started(false);
+        std::vector<unsigned long> hits(config.processCount, 0);
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < config.processCount; i++) {
+            threads.emplace_back(&Benchmark::runProcess, this, std::ref(system), processes[i], generators[i],
+                                 std::cref(config), i + 1, std::cref(started), &hits[i]);
+        }
+        auto start = std::chrono::steady_clock::now();
+        started = true;
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        done = true;
+        ticker.join();
+        result.stats = system.getStats();
+        result.accesses = config.processCount * config.accessesPerProcess;
+        for (auto processHits : hits) {
+            result.hits += processHits;
+        }
+        for (auto process : processes) {
+            delete process;
+        }
+        for (auto generator : generators) {
+            delete generator;
+        }
+    }
+    delete[] vmSpace;
+    delete[] pmtSpace;
+    return result;
+}
+
+void Benchmark::runProcess(System &system, Process *process, WorkloadGenerator *generator,
+                           const BenchmarkConfig &config, unsigned seed, const std::atomic<bool> &started,
+                           unsigned long *hits) {
+    ProcessId pid = process->getProcessId();
+    std::minstd_rand randomGenerator(seed);
+    std::uniform_real_distribution<double> writeChance(0, 1);
+    unsigned long processHits = 0;
+    while (!started) {
+        std::this_thread::yield();
+    }
+    for (unsigned long i = 0; i < config.accessesPerProcess; i++) {
+        VirtualAddress address = PAGE_SIZE + generator->nextPage() * PAGE_SIZE + randomGenerator() % PAGE_SIZE;
+        AccessType type = (writeChance(randomGenerator) < config.writeFraction) ? WRITE : READ;
+        Status status = system.access(pid, address, type);
+        if (status == OK) {
+            processHits++;
+        }
+        while (status == PAGE_FAULT) {
+            if (OK != process->pageFault(address)) {
+                std::cout << "Page fault failed in process " << pid << " at " << address << std::endl;
+                break;
+            }
+            status = system.access(pid, address, type);
+        }
+    }
+    *hits = processHits;
+}
+
+void Benchmark::printCsvHeader(std::ostream &out) {
+    out << "workload,processes,memory,pmt_space,accesses,seconds,accesses_per_second,hit_rate,minor_faults,"
+           "major_faults,faults_per_second,mean_fault_us,clean_evictions,dirty_evictions,cluster_reads,"
+           "cluster_writes\n";
+}
+
+void Benchmark::printCsv(std::ostream &out, const BenchmarkResult &result) {
+    const ProcessStats &stats = result.stats.processes;
+    unsigned long faults = stats.minorFaults + stats.majorFaults;
+    out << result.workload << "," << result.config.processCount << "," << result.config.memorySize << ","
+        << result.config.pmtSpaceSize << "," << result.accesses << "," << result.seconds << ","
+        << (result.seconds > 0 ? result.accesses / result.seconds : 0) << ","
+        << (result.accesses ? (double) result.hits / result.accesses : 0) << "," << stats.minorFaults << ","
+        << stats.majorFaults << "," << (result.seconds > 0 ? faults / result.seconds : 0) << ","
+        << getMeanMicroseconds(stats.faultLatency) << "," << stats.cleanEvictions << "," << stats.dirtyEvictions << ","
+        << result.stats.clusterReads << "," << result.stats.clusterWrites << "\n";
+}
+
+void Benchmark::printJson(std::ostream &out, const std::vector<BenchmarkResult> &results) {
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult &result = results[i];
+        const ProcessStats &stats = result.stats.processes;
+        unsigned long faults = stats.minorFaults + stats.majorFaults;
+        out << "  {\"workload\": \"" << result.workload << "\", \"processes\": " << result.config.processCount
+            << ", \"memory\": " << result.config.memorySize << ", \"pmt_space\": " << result.config.pmtSpaceSize
+            << ", \"accesses\": " << result.accesses << ", \"seconds\": " << result.seconds
+            << ", \"accesses_per_second\": " << (result.seconds > 0 ? result.accesses / result.seconds : 0)
+            << ", \"hit_rate\": " << (result.accesses ? (double) result.hits / result.accesses : 0)
+            << ", \"minor_faults\": " << stats.minorFaults << ", \"major_faults\": " << stats.majorFaults
+            << ", \"faults_per_second\": " << (result.seconds > 0 ? faults / result.seconds : 0)
+            << ", \"mean_fault_us\": " << getMeanMicroseconds(stats.faultLatency)
+            << ", \"clean_evictions\": " << stats.cleanEvictions << ", \"dirty_evictions\": " << stats.dirtyEvictions
+            << ", \"cluster_reads\": " << result.stats.clusterReads
+            << ", \"cluster_writes\": " << result.stats.clusterWrites << "}" << (i + 1 < results.size() ? "," : "")
+            << "\n";
+    }
+    out << "]\n";
+}
@@ -0,0 +1,56 @@
+#ifndef VM_BENCHMARK_H
+#define VM_BENCHMARK_H
+
+
+#include <atomic>
+#include <ostream>
+#include <vector>
+#include "vm_declarations.h"
+#include "Process.h"
+#include "System.h"
+#include "WorkloadGenerator.h"
+
+class Partition;
+
+typedef struct BenchmarkConfig {
+    unsigned processCount;
+    // frames of physical memory, shared by all processes
+    PageNum memorySize;
+    PageNum pmtSpaceSize;
+    // every process's segment is this many times its share of memory
+    double overcommit;
+    unsigned long accessesPerProcess;
+    double writeFraction;
+} BenchmarkConfig;
+
+typedef struct BenchmarkResult {
+    const char *workload;
+    BenchmarkConfig config;
+    double seconds;
+    unsigned long accesses;
+    // accesses that went through without faulting first
+    unsigned long hits;
+    SystemStats stats;
+} BenchmarkResult;
+
+// Runs a workload on a fresh system, every process in a thread of its own with its own generator,
+// while the periodic job ticks along; results come out as CSV or JSON for comparing runs.
+class Benchmark {
+public:
+    explicit Benchmark(Partition &partition);
+    // A configuration that does not fit, such as one with too little pmt space for its processes,
+    // comes back without any accesses
+    BenchmarkResult run(const WorkloadGenerator &workload, const BenchmarkConfig &config);
+
+    static void printCsvHeader(std::ostream &out);
+    static void printCsv(std::ostream &out, const BenchmarkResult &result);
+    static void printJson(std::ostream &out, const std::vector<BenchmarkResult> &results);
+private:
+    void runProcess(System &system, Process *process, WorkloadGenerator *generator, const BenchmarkConfig &config,
+                    unsigned seed, const std::atomic<bool> &started, unsigned long *hits);
+
+    Partition &partition;
+};
+
+
+#endif //VM_BENCHMARK_H
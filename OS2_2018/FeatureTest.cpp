@@ -0,0 +1,498 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <memory>
+#include "FeatureTest.h"
+#include "TestUtils.h"
+#include "part.h"
+
+#define FEATURE_FRAMES (64)
+// room for the pmts of every process a test has at once
+#define FEATURE_PMT_SPACE (8 * SIZE_OF_PMT_IN_PAGES)
+#define FEATURE_SEGMENT_SIZE (16)
+// evictAll's process has this much virtual memory, but only ever touches twice FEATURE_FRAMES pages of it
+#define FEATURE_EVICTION_SEGMENT_SIZE (64 * FEATURE_FRAMES)
+#define FEATURE_ACCESSES_PER_TICK (16)
+
+// a fresh system with memory of its own; the memory is declared first, so it outlives the system
+class TestSystem {
+public:
+    TestSystem(Partition &partition, PageNum frames)
+            : vmSpace(new char[(frames + 2) * PAGE_SIZE]), pmtSpace(new char[(FEATURE_PMT_SPACE + 2) * PAGE_SIZE]),
+              system(alignToPage(vmSpace.get()), frames, alignToPage(pmtSpace.get()), FEATURE_PMT_SPACE, &partition) {
+    }
+
+    std::unique_ptr<char[]> vmSpace;
+    std::unique_ptr<char[]> pmtSpace;
+    System system;
+};
+
+FeatureTest::FeatureTest(Partition &partition_) : partition(partition_), errorCount(0) {
+}
+
+void FeatureTest::run() {
+    testAdvise();
+    testLock();
+    testSuspend();
+    testClone(true);
+    testClone(false);
+    testSharedSegment();
+    testMapSegment();
+    testResizeAndMove();
+    testHotplug();
+}
+
+unsigned long FeatureTest::getErrorCount() const {
+    return errorCount;
+}
+
+void FeatureTest::testAdvise() {
+    TestSystem testSystem(partition, FEATURE_FRAMES);
+    System &system = testSystem.system;
+    Process *process = system.createProcess();
+    const VirtualAddress zeroed = PAGE_SIZE, mapped = zeroed + 2 * FEATURE_SEGMENT_SIZE * PAGE_SIZE;
+    std::vector<char> content(FEATURE_SEGMENT_SIZE * PAGE_SIZE);
+    std::vector<char> zeroedShadow(FEATURE_SEGMENT_SIZE, 0), mappedShadow(FEATURE_SEGMENT_SIZE);
+    for (PageNum page = 0; page < FEATURE_SEGMENT_SIZE; page++) {
+        mappedShadow[page] = content[page * PAGE_SIZE] = (char) (page + 1);
+    }
+    expect(OK == process->createSegment(zeroed, FEATURE_SEGMENT_SIZE, READ_WRITE), "create segment");
+    expect(OK == process->mapSegment(mapped, FEATURE_SEGMENT_SIZE, READ_WRITE, content.data()), "map segment");
+
+    // dropped pages come back as the segment started out, whether they were resident or swapped out
+    std::vector<char> dropped(FEATURE_SEGMENT_SIZE);
+    fill(system, process, zeroed, dropped, 50);
+    fill(system, process, mapped, dropped, 100);
+    evictAll(system);
+    fill(system, process, zeroed, dropped, 60);
+    fill(system, process, mapped, dropped, 110);
+    evictAll(system);
+    expect(OK == process->advise(zeroed, FEATURE_SEGMENT_SIZE, ADVICE_DONTNEED), "advise DONTNEED");
+    expect(OK == process->advise(mapped, FEATURE_SEGMENT_SIZE, ADVICE_DONTNEED), "advise DONTNEED");
+    verify(system, process, zeroed, zeroedShadow, "dropped page of a created segment");
+    verify(system, process, mapped, mappedShadow, "dropped page of a mapped segment");
+    expect(TRAP == process->advise(zeroed + FEATURE_SEGMENT_SIZE * PAGE_SIZE, 1, ADVICE_DONTNEED),
+           "advise outside of any segment");
+
+    // a sequential scan over swapped out pages reads the ones ahead of it in with each fault
+    std::vector<char> shadow(FEATURE_SEGMENT_SIZE);
+    fill(system, process, zeroed, shadow, 1);
+    evictAll(system);
+    expect(OK == process->advise(zeroed, FEATURE_SEGMENT_SIZE, ADVICE_SEQUENTIAL), "advise SEQUENTIAL");
+    ProcessStats before = process->getStats();
+    verify(system, process, zeroed, shadow, "page read sequentially");
+    ProcessStats after = process->getStats();
+    expect(after.prefetchedPages > before.prefetchedPages, "pages prefetched by a sequential scan");
+    expect(after.prefetchHits > before.prefetchHits, "prefetched pages hit by a sequential scan");
+
+    delete process;
+}
+
+void FeatureTest::testLock() {
+    TestSystem testSystem(partition, FEATURE_FRAMES);
+    System &system = testSystem.system;
+    Process *process = system.createProcess();
+    // the default pin quota of a process is just enough for one segment
+    const PageNum lockedSize = FEATURE_FRAMES / DEFAULT_PIN_QUOTA_DIVISOR;
+    const VirtualAddress locked = PAGE_SIZE, unlocked = locked + 2 * lockedSize * PAGE_SIZE;
+    expect(OK == process->createSegment(locked, lockedSize, READ_WRITE), "create segment");
+    expect(OK == process->createSegment(unlocked, lockedSize, READ_WRITE), "create segment");
+    expect(OK == process->lockSegment(locked), "lock segment");
+    expect(TRAP == process->lockSegment(unlocked), "lock segment over the pin quota");
+    std::vector<char> lockedShadow(lockedSize), unlockedShadow(lockedSize);
+    fill(system, process, locked, lockedShadow, 1);
+    fill(system, process, unlocked, unlockedShadow, 50);
+
+    // pinned pages stay where they are however much is evicted around them
+    system.startTrace();
+    evictAll(system);
+    system.stopTrace();
+    std::vector<TraceEvent> trace = system.getTrace();
+    expect(!countEvictions(trace, process, locked, lockedSize), "no evictions of pinned pages");
+    expect(countEvictions(trace, process, unlocked, lockedSize) == lockedSize, "evictions of unpinned pages");
+    ProcessStats before = process->getStats();
+    verify(system, process, locked, lockedShadow, "pinned page");
+    verify(system, process, unlocked, unlockedShadow, "unpinned page");
+    ProcessStats after = process->getStats();
+    expect(after.majorFaults - before.majorFaults == lockedSize, "faults on the unpinned pages only");
+    expect(TRAP == process->advise(locked, lockedSize, ADVICE_DONTNEED), "advise DONTNEED on pinned pages");
+
+    // a bigger quota lets the process pin more, but never more than half of memory over all processes
+    expect(OK == system.setPinQuota(process->getProcessId(), FEATURE_FRAMES), "set pin quota");
+    expect(OK == process->lockSegment(unlocked), "lock segment in the pin quota");
+    Process *other = system.createProcess();
+    expect(OK == other->createSegment(locked, FEATURE_FRAMES / MAX_PINNED_DIVISOR, READ_WRITE), "create segment");
+    expect(OK == system.setPinQuota(other->getProcessId(), FEATURE_FRAMES), "set pin quota");
+    expect(TRAP == other->lockSegment(locked), "lock segment over the system's pinned memory");
+    expect(OK == process->unlockSegment(unlocked), "unlock segment");
+    expect(OK == process->unlockSegment(locked), "unlock segment");
+    expect(OK == other->lockSegment(locked), "lock segment once pinned memory was released");
+
+    // unlocked pages are evicted like any other
+    system.startTrace();
+    evictAll(system);
+    system.stopTrace();
+    expect(countEvictions(system.getTrace(), process, locked, lockedSize) == lockedSize, "evictions of unlocked pages");
+    verify(system, process, locked, lockedShadow, "unlocked page");
+
+    delete other;
+    delete process;
+}
+
+void FeatureTest::testSuspend() {
+    TestSystem testSystem(partition, FEATURE_FRAMES);
+    System &system = testSystem.system;
+    Process *process = system.createProcess();
+    const VirtualAddress first = PAGE_SIZE, second = first + 2 * FEATURE_SEGMENT_SIZE * PAGE_SIZE;
+    expect(OK == process->createSegment(first, FEATURE_SEGMENT_SIZE, READ_WRITE), "create segment");
+    expect(OK == process->createSegment(second, FEATURE_SEGMENT_SIZE, READ_WRITE), "create segment");
+    std::vector<char> firstShadow(FEATURE_SEGMENT_SIZE), secondShadow(FEATURE_SEGMENT_SIZE);
+    fill(system, process, first, firstShadow, 1);
+    fill(system, process, second, secondShadow, 50);
+
+    // a suspended process keeps none of its memory, and gets back the pages it had once it is resumed
+    expect(OK == system.suspendProcess(process->getProcessId()), "suspend process");
+    expect(TRAP == system.suspendProcess(process->getProcessId()), "suspend a suspended process");
+    evictAll(system);
+    expect(OK == system.resumeProcess(process->getProcessId()), "resume process");
+    expect(TRAP == system.resumeProcess(process->getProcessId()), "resume a running process");
+    ProcessStats before = process->getStats();
+    verify(system, process, first, firstShadow, "resumed page");
+    verify(system, process, second, secondShadow, "resumed page");
+    ProcessStats after = process->getStats();
+    expect(after.majorFaults == before.majorFaults, "no faults on the pages brought back by resume");
+
+    // pinned pages cannot be swapped out, so a process with locked segments is not suspended
+    expect(OK == system.setPinQuota(process->getProcessId(), FEATURE_SEGMENT_SIZE), "set pin quota");
+    expect(OK == process->lockSegment(first), "lock segment");
+    expect(TRAP == system.suspendProcess(process->getProcessId()), "suspend a process with a locked segment");
+    verify(system, process, first, firstShadow, "page of a process that failed to suspend");
+    expect(OK == process->unlockSegment(first), "unlock segment");
+    expect(OK == system.suspendProcess(process->getProcessId()), "suspend process once unlocked");
+    expect(OK == system.resumeProcess(process->getProcessId()), "resume process");
+    verify(system, process, first, firstShadow, "resumed page");
+    expect(TRAP == system.suspendProcess(process->getProcessId() + 1), "suspend a process that does not exist");
+
+    delete process;
+}
+
+void FeatureTest::testClone(bool parentFirst) {
+    TestSystem testSystem(partition, FEATURE_FRAMES);
+    System &system = testSystem.system;
+    Process *parent = system.createProcess();
+    const VirtualAddress startAddress = PAGE_SIZE;
+    expect(OK == parent->createSegment(startAddress, FEATURE_SEGMENT_SIZE, READ_WRITE), "create segment");
+    std::vector<char> parentShadow(FEATURE_SEGMENT_SIZE);
+    fill(system, parent, startAddress, parentShadow, 1);
+    // the second half is swapped out when the process is cloned, the first half is resident
+    evictAll(system);
+    std::vector<char> half(parentShadow.begin(), parentShadow.begin() + FEATURE_SEGMENT_SIZE / 2);
+    verify(system, parent, startAddress, half, "page before clone");
+
+    Process *child = system.cloneProcess(parent->getProcessId());
+    expect(child != 0, "clone process");
+    if (!child) {
+        delete parent;
+        return;
+    }
+    expect(!system.cloneProcess(child->getProcessId() + 1), "clone a process that does not exist");
+    std::vector<char> childShadow = parentShadow;
+    verify(system, child, startAddress, childShadow, "cloned page");
+
+    // writes on either side stay on that side, whether the page was resident or swapped out when cloned
+    for (PageNum page = 0; page < FEATURE_SEGMENT_SIZE; page++) {
+        VirtualAddress address = startAddress + page * PAGE_SIZE;
+        if (page % 3 != 1) {
+            char value = (char) (50 + page);
+            expect(touch(system, child, address, WRITE, &value), "write access");
+            childShadow[page] = value;
+        }
+        if (page % 3 != 2) {
+            char value = (char) (100 + page);
+            expect(touch(system, parent, address, WRITE, &value), "write access");
+            parentShadow[page] = value;
+        }
+    }
+    verify(system, parent, startAddress, parentShadow, "page of the parent");
+    verify(system, child, startAddress, childShadow, "page of the child");
+    evictAll(system);
+    verify(system, child, startAddress, childShadow, "swapped page of the child");
+    verify(system, parent, startAddress, parentShadow, "swapped page of the parent");
+
+    // whichever goes first takes only its own pages along
+    evictAll(system);
+    if (parentFirst) {
+        delete parent;
+        verify(system, child, startAddress, childShadow, "page of the child once the parent is gone");
+        delete child;
+    } else {
+        delete child;
+        verify(system, parent, startAddress, parentShadow, "page of the parent once the child is gone");
+        delete parent;
+    }
+}
+
+void FeatureTest::testSharedSegment() {
+    TestSystem testSystem(partition, FEATURE_FRAMES);
+    System &system = testSystem.system;
+    Process *writer = system.createProcess(), *reader = system.createProcess();
+    // the processes map the segment at different addresses
+    const VirtualAddress writerAddress = PAGE_SIZE, readerAddress = writerAddress + 2 * FEATURE_SEGMENT_SIZE * PAGE_SIZE;
+    const char *name = "feature";
+    expect(OK == writer->createSharedSegment(writerAddress, FEATURE_SEGMENT_SIZE, name, READ_WRITE),
+           "create shared segment");
+    expect(TRAP == reader->createSharedSegment(readerAddress, FEATURE_SEGMENT_SIZE, name, READ_WRITE),
+           "create a shared segment that exists");
+    expect(TRAP == reader->attachSharedSegment(readerAddress, "missing", READ), "attach a missing shared segment");
+    expect(OK == reader->attachSharedSegment(readerAddress, name, READ), "attach shared segment");
+    std::vector<char> shadow(FEATURE_SEGMENT_SIZE);
+    fill(system, writer, writerAddress, shadow, 1);
+    verify(system, reader, readerAddress, shadow, "shared page");
+    char value = 0;
+    expect(!touch(system, reader, readerAddress, WRITE, &value), "write to a shared segment attached for reading");
+
+    // what one process wrote reaches the other after it was swapped out, and after the writer detached
+    evictAll(system);
+    verify(system, reader, readerAddress, shadow, "swapped shared page");
+    fill(system, writer, writerAddress, shadow, 50);
+    evictAll(system);
+    expect(OK == writer->deleteSegment(writerAddress), "detach shared segment");
+    verify(system, reader, readerAddress, shadow, "shared page once the writer detached");
+    expect(TRAP == writer->createSharedSegment(writerAddress, FEATURE_SEGMENT_SIZE, name, READ_WRITE),
+           "create a shared segment still attached");
+
+    // the last process to detach frees the segment, so the name starts over with fresh pages
+    expect(OK == reader->deleteSegment(readerAddress), "detach shared segment");
+    expect(TRAP == reader->attachSharedSegment(readerAddress, name, READ), "attach a freed shared segment");
+    expect(OK == writer->createSharedSegment(writerAddress, FEATURE_SEGMENT_SIZE, name, READ_WRITE),
+           "create a freed shared segment again");
+    verify(system, writer, writerAddress, std::vector<char>(FEATURE_SEGMENT_SIZE, 0), "fresh shared page");
+
+    delete reader;
+    delete writer;
+}
+
+void FeatureTest::testMapSegment() {
+    TestSystem testSystem(partition, FEATURE_FRAMES);
+    System &system = testSystem.system;
+    Process *process = system.createProcess();
+    const VirtualAddress startAddress = PAGE_SIZE;
+    std::vector<char> content(FEATURE_SEGMENT_SIZE * PAGE_SIZE), shadow(FEATURE_SEGMENT_SIZE);
+    for (PageNum page = 0; page < FEATURE_SEGMENT_SIZE; page++) {
+        shadow[page] = content[page * PAGE_SIZE] = (char) (page + 1);
+    }
+    expect(OK == process->mapSegment(startAddress, FEATURE_SEGMENT_SIZE, READ_WRITE, content.data()),
+           "map segment");
+    verify(system, process, startAddress, shadow, "mapped page");
+
+    // clean pages are filled from the content again, without reading the partition
+    evictAll(system);
+    ProcessStats before = process->getStats();
+    verify(system, process, startAddress, shadow, "clean mapped page");
+    ProcessStats after = process->getStats();
+    expect(after.majorFaults == before.majorFaults, "no partition reads for clean mapped pages");
+    expect(after.minorFaults - before.minorFaults == FEATURE_SEGMENT_SIZE, "minor faults for clean mapped pages");
+
+    // a page written to goes to the partition when evicted and comes back from there, not from the content,
+    // which the segment never writes to
+    const PageNum dirtyPage = FEATURE_SEGMENT_SIZE / 2;
+    char value = 100;
+    expect(touch(system, process, startAddress + dirtyPage * PAGE_SIZE, WRITE, &value), "write access");
+    shadow[dirtyPage] = value;
+    evictAll(system);
+    expect(content[dirtyPage * PAGE_SIZE] == (char) (dirtyPage + 1), "content left as it was");
+    before = process->getStats();
+    verify(system, process, startAddress, shadow, "dirtied mapped page");
+    after = process->getStats();
+    expect(after.majorFaults - before.majorFaults == 1, "a partition read for the dirtied page only");
+
+    delete process;
+}
+
+void FeatureTest::testResizeAndMove() {
+    TestSystem testSystem(partition, FEATURE_FRAMES);
+    System &system = testSystem.system;
+    Process *process = system.createProcess();
+    const VirtualAddress startAddress = PAGE_SIZE, neighbour = startAddress + 4 * FEATURE_SEGMENT_SIZE * PAGE_SIZE;
+    const VirtualAddress movedAddress = neighbour + 4 * FEATURE_SEGMENT_SIZE * PAGE_SIZE;
+    expect(OK == process->createSegment(startAddress, FEATURE_SEGMENT_SIZE, READ_WRITE), "create segment");
+    expect(OK == process->createSegment(neighbour, 1, READ_WRITE), "create segment");
+    std::vector<char> shadow(FEATURE_SEGMENT_SIZE);
+    fill(system, process, startAddress, shadow, 1);
+    // half of the pages are swapped out, half are resident
+    evictAll(system);
+    verify(system, process, startAddress, std::vector<char>(shadow.begin(), shadow.begin() + FEATURE_SEGMENT_SIZE / 2),
+           "page before resize");
+
+    // growing keeps the pages there are, and the new ones read as zeros
+    expect(TRAP == process->resizeSegment(startAddress, 5 * FEATURE_SEGMENT_SIZE), "grow into the next segment");
+    expect(OK == process->resizeSegment(startAddress, 2 * FEATURE_SEGMENT_SIZE), "grow segment");
+    shadow.resize(2 * FEATURE_SEGMENT_SIZE, 0);
+    verify(system, process, startAddress, shadow, "grown page");
+
+    // moving takes the pages along, resident or not, and leaves nothing at the old address
+    evictAll(system);
+    verify(system, process, startAddress, std::vector<char>(shadow.begin(), shadow.begin() + FEATURE_SEGMENT_SIZE),
+           "page before move");
+    expect(TRAP == process->moveSegment(startAddress, neighbour), "move onto the next segment");
+    expect(OK == process->moveSegment(startAddress, movedAddress), "move segment");
+    char value;
+    expect(!touch(system, process, startAddress, READ, &value), "access at the old address");
+    verify(system, process, movedAddress, shadow, "moved page");
+
+    // pages cut off by shrinking come back as zeros when the segment grows again
+    fill(system, process, movedAddress, shadow, 50);
+    evictAll(system);
+    expect(OK == process->resizeSegment(movedAddress, FEATURE_SEGMENT_SIZE / 2), "shrink segment");
+    expect(!touch(system, process, movedAddress + FEATURE_SEGMENT_SIZE * PAGE_SIZE, READ, &value),
+           "access past the end of a shrunk segment");
+    expect(OK == process->resizeSegment(movedAddress, 2 * FEATURE_SEGMENT_SIZE), "grow segment");
+    std::fill(shadow.begin() + FEATURE_SEGMENT_SIZE / 2, shadow.end(), 0);
+    verify(system, process, movedAddress, shadow, "regrown page");
+
+    delete process;
+}
+
+void FeatureTest::testHotplug() {
+    TestSystem testSystem(partition, FEATURE_FRAMES);
+    System &system = testSystem.system;
+    std::unique_ptr<char[]> addedSpace(new char[(FEATURE_FRAMES + 2) * PAGE_SIZE]);
+    PhysicalAddress added = alignToPage(addedSpace.get());
+    uint64_t addedFirst = (uint64_t) added / PAGE_SIZE, addedEnd = addedFirst + FEATURE_FRAMES;
+    expect(TRAP == system.addPhysicalMemory(testSystem.vmSpace.get() + PAGE_SIZE, 1), "add memory the system has");
+    expect(OK == system.addPhysicalMemory(added, FEATURE_FRAMES), "add memory");
+
+    // with twice the memory, a process can have more pages resident than there were frames to begin with
+    Process *process = system.createProcess();
+    const VirtualAddress startAddress = PAGE_SIZE;
+    const PageNum size = FEATURE_FRAMES + FEATURE_FRAMES / 2;
+    expect(OK == process->createSegment(startAddress, size, READ_WRITE), "create segment");
+    std::vector<char> shadow(size);
+    system.startTrace();
+    fill(system, process, startAddress, shadow, 1);
+    system.stopTrace();
+    unsigned long faultsInAdded = 0;
+    for (auto &event : system.getTrace()) {
+        if ((event.type == TRACE_FAULT) && (event.frame >= addedFirst) && (event.frame < addedEnd)) {
+            faultsInAdded++;
+        }
+    }
+    expect(faultsInAdded > 0, "faults into the added memory");
+
+    // taking the memory back evicts what lives there, while another process keeps faulting its pages in
+    // the other process sweeps over more pages than there are frames, so it never stops faulting
+    Process *other = system.createProcess();
+    expect(OK == other->createSegment(startAddress, 2 * FEATURE_FRAMES, READ_WRITE), "create segment");
+    std::atomic<bool> started(false), done(false);
+    std::thread faulting([this, &system, other, startAddress, &started, &done]() {
+        std::vector<char> otherShadow(2 * FEATURE_FRAMES);
+        for (char first = 0; !done; first++) {
+            fill(system, other, startAddress, otherShadow, first);
+            started = true;
+            verify(system, other, startAddress, otherShadow, "page faulted during reclaim");
+        }
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+    PhysicalAddress reclaimed = 0;
+    expect(OK == system.reclaimPhysicalMemory(FEATURE_FRAMES, &reclaimed), "reclaim memory");
+    expect(reclaimed == added, "reclaimed memory is what was added");
+    done = true;
+    faulting.join();
+
+    // nothing lives in the reclaimed memory anymore, so whatever is written there does not show
+    memset(addedSpace.get(), -1, (FEATURE_FRAMES + 2) * PAGE_SIZE);
+    verify(system, process, startAddress, shadow, "page evicted by reclaim");
+    expect(TRAP == system.reclaimPhysicalMemory(FEATURE_FRAMES, &reclaimed), "reclaim all of memory");
+
+    delete other;
+    delete process;
+}
+
+bool FeatureTest::touch(System &system, Process *process, VirtualAddress address, AccessType type, char *value) {
+    ProcessId pid = process->getProcessId();
+    PhysicalAddress pa = 0;
+    unsigned slot = system.beginAccess(pid);
+    Status status = system.access(pid, address, type, &pa);
+    while (status == PAGE_FAULT) {
+        system.endAccess(pid, slot);
+        if (OK != process->pageFault(address)) {
+            return false;
+        }
+        slot = system.beginAccess(pid);
+        status = system.access(pid, address, type, &pa);
+    }
+    if (status == OK) {
+        if (type == WRITE) {
+            *(char *) pa = *value;
+        } else {
+            *value = *(char *) pa;
+        }
+    }
+    system.endAccess(pid, slot);
+    return status == OK;
+}
+
+void FeatureTest::fill(System &system, Process *process, VirtualAddress startAddress, std::vector<char> &shadow,
+                       char first) {
+    for (PageNum page = 0; page < shadow.size(); page++) {
+        char value = (char) (first + page);
+        if (!touch(system, process, startAddress + page * PAGE_SIZE, WRITE, &value)) {
+            errorCount++;
+            std::cout << "Process " << process->getProcessId() << " cannot write page " << page << std::endl;
+            return;
+        }
+        shadow[page] = value;
+    }
+}
+
+void FeatureTest::verify(System &system, Process *process, VirtualAddress startAddress,
+                         const std::vector<char> &shadow, const char *what) {
+    for (PageNum page = 0; page < shadow.size(); page++) {
+        char value;
+        if (!touch(system, process, startAddress + page * PAGE_SIZE, READ, &value)) {
+            errorCount++;
+            std::cout << "Process " << process->getProcessId() << " cannot read " << what << " " << page << std::endl;
+        } else if (value != shadow[page]) {
+            errorCount++;
+            std::cout << "Process " << process->getProcessId() << " read " << (int) value << " instead of "
+                      << (int) shadow[page] << " from " << what << " " << page << std::endl;
+        }
+    }
+}
+
+void FeatureTest::evictAll(System &system) {
+    Process *process = system.createProcess();
+    const VirtualAddress startAddress = PAGE_SIZE;
+    expect(OK == process->createSegment(startAddress, FEATURE_EVICTION_SEGMENT_SIZE, READ_WRITE),
+           "create eviction segment");
+    for (PageNum page = 0; page < 2 * FEATURE_FRAMES; page++) {
+        char value = (char) page;
+        touch(system, process, startAddress + page * PAGE_SIZE, WRITE, &value);
+        if (!(page % FEATURE_ACCESSES_PER_TICK)) {
+            system.periodicJob();
+        }
+    }
+    delete process;
+}
+
+unsigned long FeatureTest::countEvictions(const std::vector<TraceEvent> &trace, Process *process,
+                                         VirtualAddress startAddress, PageNum count) {
+    unsigned long evictions = 0;
+    for (auto &event : trace) {
+        if ((event.type == TRACE_EVICTION) && (event.pid == process->getProcessId()) &&
+            (event.page >= startAddress / PAGE_SIZE) && (event.page < startAddress / PAGE_SIZE + count)) {
+            evictions++;
+        }
+    }
+    return evictions;
+}
+
+void FeatureTest::expect(bool condition, const char *what) {
+    if (!condition) {
+        errorCount++;
+        std::cout << "Failed: " << what << std::endl;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef VM_FEATURETEST_H
+#define VM_FEATURETEST_H
+
+
+#include <atomic>
+#include <vector>
+#include "vm_declarations.h"
+#include "Process.h"
+#include "System.h"
+
+class Partition;
+
+// Goes through the kernel features one at a time, every test on a fresh system with few frames so that pages
+// get evicted soon. Each page a test uses is told apart by its first byte, which is kept in a shadow;
+// a check that fails is printed and counted, and the tests go on. Only the hotplug test has a second thread.
+class FeatureTest {
+public:
+    explicit FeatureTest(Partition &partition);
+    void run();
+    unsigned long getErrorCount() const;
+private:
+    void testAdvise();
+    void testLock();
+    void testSuspend();
+    // Runs twice, deleting the parent first and then the child first
+    void testClone(bool parentFirst);
+    void testSharedSegment();
+    void testMapSegment();
+    void testResizeAndMove();
+    void testHotplug();
+
+    // Writes the value to the address, or reads it from there, as the hardware does, faulting the page in until
+    // the access goes through; returns false if it trapped
+    bool touch(System &system, Process *process, VirtualAddress address, AccessType type, char *value);
+    // Writes a value of its own to every page of the range, starting at the given one, and to the shadow
+    void fill(System &system, Process *process, VirtualAddress startAddress, std::vector<char> &shadow, char first);
+    // Reads every page of the range back, counting an error for each one that does not match the shadow
+    void verify(System &system, Process *process, VirtualAddress startAddress, const std::vector<char> &shadow,
+                const char *what);
+    // Sweeps a process of its own over twice as many pages as there are frames, out of a segment so big that
+    // the other processes' share of memory comes to nothing, so they lose every page that can be evicted
+    void evictAll(System &system);
+    // Counts the evictions the trace has of the process's pages in the range
+    unsigned long countEvictions(const std::vector<TraceEvent> &trace, Process *process, VirtualAddress startAddress,
+                                 PageNum count);
+    void expect(bool condition, const char *what);
+
+    Partition &partition;
+    std::atomic<unsigned long> errorCount;
+};
+
+
+#endif //VM_FEATURETEST_H
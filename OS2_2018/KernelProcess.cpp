@@ -1,16 +1,33 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
 #include "KernelProcess.h"
 #include "KernelSystem.h"
 
+static_assert(sizeof(std::atomic<pte_t>) == sizeof(pte_t), "page tables are laid out as plain words in the pmt space");
+
 KernelProcess::KernelProcess(ProcessId pid) {
 	this->pid = pid;
+	accessSlot = 0;
+	activeAccesses[0] = 0;
+	activeAccesses[1] = 0;
+	physicalMemory = 0;
+	virtualMemory = 0;
+	pinnedMemory = 0;
+	repc.rootCluster = 0;
+	repc.rootEntry = 0;
+	repc.processCluster = 0;
 }
 
 KernelProcess::~KernelProcess() {
-	while (!segments.empty()) {
-		auto s = segments.begin();
-		deleteSegment(s->first);
+	{
+		KERNEL_LOCK(lock, _prefetchMutex);
+		prefetchDone.wait(lock, [this]() { return !pendingPrefetches; });
 	}
-	pSystem->eraseProcessFromPartition_s(pid);
+	pSystem->removeProcess_s(pid);
+	releaseFrames_s();
+	// every cluster the process has goes back in one go, so there is no need to erase its pages one by one
+	pSystem->eraseProcessFromPartition_s(this);
 	pSystem->giveToPmtPool_s((PhysicalAddress)pmt);
 	//pSystem->printPmtPoolTop();
 }
@@ -21,84 +38,134 @@ ProcessId KernelProcess::getProcessId() const {
 
 Status KernelProcess::createSegment(VirtualAddress startAddress, PageNum segmentSize,
 		AccessType flags) {
+	return createSegment(startAddress, segmentSize, flags, 0, 0, false);
+}
+
+Status KernelProcess::createSegment(VirtualAddress startAddress, PageNum segmentSize,
+		AccessType flags, SharedSegment* shared, const char* content, bool swapped) {
 	if (startAddress % PAGE_SIZE) {
 		return TRAP;
 	}
-
-	Segment* s = new Segment();
-	s->startAddress = startAddress;
-	s->size = segmentSize;
-	s->physicalSize = 0;
-	segments[startAddress] = s;
-
-	auto currSegment = segments.find(startAddress),
-		prevSegment = currSegment,
-		nextSegment = currSegment;
-	prevSegment--;
-	nextSegment++;
-	if (((prevSegment != segments.end()) && (prevSegment->second->startAddress + prevSegment->second->size * PAGE_SIZE > currSegment->second->startAddress))
-			|| ((nextSegment != segments.end()) && (currSegment->second->startAddress + currSegment->second->size * PAGE_SIZE > nextSegment->second->startAddress))) {
-		segments.erase(currSegment);
+	VirtualAddress endAddress = startAddress + segmentSize * PAGE_SIZE;
+	if (endAddress > (VirtualAddress)PMT_SIZE * PAGE_SIZE) {
 		return TRAP;
 	}
+	KERNEL_LOCK(lock, _mutex);
 
-	for (PageNum currentPage = 0; currentPage < segmentSize; currentPage++) {
-		VirtualAddress currentAddress = startAddress + currentPage * PAGE_SIZE;
-		PTE entry;
-		getPTE(currentAddress, &entry);
-		if (entry.mapped) {
-			segments.erase(currSegment);
+	// only the neighbours can overlap, the one starting at or after us and the one before that
+	auto nextSegment = segments.lower_bound(startAddress);
+	if ((nextSegment != segments.end()) && ((nextSegment->first < endAddress) || (nextSegment->first == startAddress))) {
+		return TRAP;
+	}
+	if (nextSegment != segments.begin()) {
+		auto prevSegment = std::prev(nextSegment);
+		if (prevSegment->first + prevSegment->second->size * PAGE_SIZE > startAddress) {
 			return TRAP;
 		}
-		entry.frame = 0;
-		entry.mapped = true;
-		entry.accessed = false;
-		entry.addBits = 0;
-		entry.dirty = false;
-		entry.flags = flags;
-		putPTE(currentAddress, entry);
 	}
 
+	// no entries are written here, the segment stands for all of its pages until they are first faulted on
+	Segment* s = new Segment();
+	s->startAddress = startAddress;
+	s->size = segmentSize;
+	s->physicalSize = 0;
+	s->advice = ADVICE_NORMAL;
+	s->locked = false;
+	s->shared = shared;
+	s->flags = flags;
+	s->content = content;
+	s->contentSize = content ? segmentSize : 0;
+	s->preloadedSize = swapped ? segmentSize : 0;
+	segments[startAddress] = s;
+	virtualMemory += segmentSize;
+	pSystem->tracer.record(TRACE_SEGMENT_CREATE, pid, startAddress, 0, segmentSize);
+
 	//printSegmentsTop();
 	//printPmtFromAddress(startAddress);
 	//printf("Done creating segment\n");
 	return OK;
 }
 
+Status KernelProcess::createSharedSegment(VirtualAddress startAddress, PageNum segmentSize,
+		const char* name, AccessType flags) {
+	if ((startAddress % PAGE_SIZE) || !name) {
+		return TRAP;
+	}
+	SharedSegment* shared = pSystem->createSharedSegment_s(name, segmentSize, flags);
+	if (!shared) {
+		return TRAP;
+	}
+	Status retVal = createSegment(startAddress, segmentSize, flags, shared, 0, false);
+	if (retVal != OK) {
+		pSystem->detachSharedSegment_s(shared);
+	}
+	return retVal;
+}
+
+Status KernelProcess::attachSharedSegment(VirtualAddress startAddress, const char* name, AccessType flags) {
+	if ((startAddress % PAGE_SIZE) || !name) {
+		return TRAP;
+	}
+	SharedSegment* shared = pSystem->attachSharedSegment_s(name);
+	if (!shared) {
+		return TRAP;
+	}
+	Status retVal = ((flags | shared->flags) == shared->flags)
+		? createSegment(startAddress, shared->pages.size(), flags, shared, 0, false) : TRAP;
+	if (retVal != OK) {
+		pSystem->detachSharedSegment_s(shared);
+	}
+	return retVal;
+}
+
 Status KernelProcess::loadSegment(VirtualAddress startAddress, PageNum segmentSize,
 		AccessType flags, void* content) {
-	Status retVal = createSegment(startAddress, segmentSize, flags);
+	Status retVal = createSegment(startAddress, segmentSize, flags, 0, 0, true);
 	if (retVal == OK) {
-		pSystem->writeToPartition_s(pid, startAddress, segmentSize, content);
+		pSystem->writeToPartition_s(this, startAddress, segmentSize, content);
 	}
 	return retVal;
 }
 
+Status KernelProcess::mapSegment(VirtualAddress startAddress, PageNum segmentSize,
+		AccessType flags, const void* content) {
+	if (!content) {
+		return TRAP;
+	}
+	// nothing is written, the pages come straight from the content the first time they are touched
+	return createSegment(startAddress, segmentSize, flags, 0, (const char*)content, false);
+}
+
 Status KernelProcess::deleteSegment(VirtualAddress startAddress) {
 	if (startAddress % PAGE_SIZE) {
 		return TRAP;
 	}
+	KERNEL_LOCK(lock, _mutex);
 	auto s = segments.find(startAddress);
 	if (s == segments.end()) {
 		return TRAP;
 	}
 
 	PageNum segmentSize = s->second->size;
-	for (PageNum currentPage = 0; currentPage < segmentSize; currentPage++) {
-		VirtualAddress currentAddress = startAddress + currentPage * PAGE_SIZE;
-		PTE pte;
-		getPTE(currentAddress, &pte);
-		if (pte.frame) {
-			pSystem->giveToBuddySystem_s(getPhysicalAddress(currentAddress), 1);
-		} else {
-			pSystem->erasePageFromPartition_s(pid, currentAddress);
-		}
-		pte.frame = 0;
-		putPTE(currentAddress, pte);
+	if (s->second->locked) {
+		pinnedMemory -= segmentSize;
+		pSystem->releasePinnedFrames(segmentSize);
 	}
-
-	pSystem->defragmentBuddySystem_s();
+	// collect the whole segment first, so the allocator and the partition are each visited only once
+	std::vector<PhysicalAddress> frames, cowFrames;
+	std::vector<SharedMapping> sharedMappings;
+	std::set<VirtualAddress> swappedPages;
+	SharedSegment* sharedSegment = s->second->shared;
+	unmapPages(lock, s->second, 0, segmentSize, &frames, &cowFrames, &sharedMappings, &swappedPages);
+	delete s->second;
 	segments.erase(s);
+	pSystem->tracer.record(TRACE_SEGMENT_DELETE, pid, startAddress, 0, segmentSize);
+	// the system locks come after ours, so let go of it while handing the pages back
+	lock.unlock();
+	releasePages_s(frames, cowFrames, sharedMappings, swappedPages);
+	if (sharedSegment) {
+		pSystem->detachSharedSegment_s(sharedSegment);
+	}
 
 	//printSegmentsTop();
 	//printPmtFromAddress(startAddress);
@@ -106,193 +173,1172 @@ Status KernelProcess::deleteSegment(VirtualAddress startAddress) {
 	return OK;
 }
 
+Status KernelProcess::resizeSegment(VirtualAddress startAddress, PageNum newSize) {
+	if ((startAddress % PAGE_SIZE) || !newSize) {
+		return TRAP;
+	}
+	KERNEL_LOCK(lock, _mutex);
+	auto s = segments.find(startAddress);
+	if (s == segments.end()) {
+		return TRAP;
+	}
+	Segment* segment = s->second;
+	// the pages of a shared segment are sized by the segment itself, and pinned ones by the quota
+	if (segment->shared || segment->locked) {
+		return TRAP;
+	}
+	PageNum oldSize = segment->size;
+	if (newSize > oldSize) {
+		// grow into the free space after the segment, the new pages start out like those of createSegment
+		auto nextSegment = s;
+		nextSegment++;
+		VirtualAddress newEnd = startAddress + newSize * PAGE_SIZE;
+		if ((newEnd > (VirtualAddress)PMT_SIZE * PAGE_SIZE)
+				|| ((nextSegment != segments.end()) && (newEnd > nextSegment->second->startAddress))) {
+			return TRAP;
+		}
+		segment->size = newSize;
+		virtualMemory += newSize - oldSize;
+		return OK;
+	}
+	if (newSize == oldSize) {
+		return OK;
+	}
+
+	std::vector<PhysicalAddress> frames, cowFrames;
+	std::vector<SharedMapping> sharedMappings;
+	std::set<VirtualAddress> swappedPages;
+	unmapPages(lock, segment, newSize, oldSize - newSize, &frames, &cowFrames, &sharedMappings, &swappedPages);
+	segment->size = newSize;
+	// growing back later must not bring back what the content or the partition had past here
+	segment->contentSize = std::min(segment->contentSize, newSize);
+	segment->preloadedSize = std::min(segment->preloadedSize, newSize);
+	lock.unlock();
+	releasePages_s(frames, cowFrames, sharedMappings, swappedPages);
+	return OK;
+}
+
+Status KernelProcess::moveSegment(VirtualAddress oldStartAddress, VirtualAddress newStartAddress) {
+	if ((oldStartAddress % PAGE_SIZE) || (newStartAddress % PAGE_SIZE) || !newStartAddress) {
+		return TRAP;
+	}
+	KERNEL_LOCK(lock, _mutex);
+	auto s = segments.find(oldStartAddress);
+	if (s == segments.end()) {
+		return TRAP;
+	}
+	Segment* segment = s->second;
+	PageNum segmentSize = segment->size;
+	VirtualAddress oldEnd = oldStartAddress + segmentSize * PAGE_SIZE, newEnd = newStartAddress + segmentSize * PAGE_SIZE;
+	if (newEnd > (VirtualAddress)PMT_SIZE * PAGE_SIZE) {
+		return TRAP;
+	}
+	// the new place may overlap the old one, but nothing else
+	for (auto other : segments) {
+		if ((other.second != segment) && (other.second->startAddress < newEnd)
+				&& (newStartAddress < other.second->startAddress + other.second->size * PAGE_SIZE)) {
+			return TRAP;
+		}
+	}
+	if (newStartAddress == oldStartAddress) {
+		return OK;
+	}
+	// pages being written out are keyed by their old address in the partition, let them land first
+	transitDone.wait(lock, [this, oldStartAddress, oldEnd]() {
+		auto page = pagesInTransit.lower_bound(oldStartAddress);
+		return (page == pagesInTransit.end()) || (*page >= oldEnd);
+	});
+
+	// the frames stay where they are, only the entries move, in the order that does not overwrite
+	// the ones yet to move when the two places overlap; translations handed out before stay valid
+	auto movePage = [this, oldStartAddress, newStartAddress](PageNum page) {
+		pte_t entry = getEntryForAddress(oldStartAddress + page * PAGE_SIZE)->exchange(0);
+		getEntryForAddress(newStartAddress + page * PAGE_SIZE)->store(entry);
+	};
+	if (newStartAddress < oldStartAddress) {
+		std::for_each(segment->materialized.begin(), segment->materialized.end(), movePage);
+	} else {
+		std::for_each(segment->materialized.rbegin(), segment->materialized.rend(), movePage);
+	}
+	for (auto& page : suspendedPages) {
+		if ((page >= oldStartAddress) && (page < oldEnd)) {
+			page = page - oldStartAddress + newStartAddress;
+		}
+	}
+	segments.erase(s);
+	segment->startAddress = newStartAddress;
+	segments[newStartAddress] = segment;
+	// the swap directory follows while we still hold the lock, so no fault can look for a page under its new address first
+	if (!segment->shared) {
+		pSystem->movePagesInPartition_s(this, oldStartAddress, newStartAddress, segmentSize);
+	}
+	return OK;
+}
+
 Status KernelProcess::pageFault(VirtualAddress address) {
 	if (!address) {
 		return TRAP;
 	}
-	VirtualAddress pageAddress = (address / PAGE_SIZE) * PAGE_SIZE;
-	PTE pte;
-	getPTE(pageAddress, &pte);
-	if (!pte.mapped) {
-		return TRAP;
+	return pageFaultRange(std::vector<VirtualAddress>(1, address));
+}
+
+Status KernelProcess::pageFaultRange(VirtualAddress startAddress, PageNum count) {
+	return pageFaultRange(startAddress, count, READ_WRITE);
+}
+
+Status KernelProcess::pageFaultRange(const std::vector<VirtualAddress>& addresses) {
+	// the caller does not say how it got the fault, it may well have been a write
+	return pageFaultRange(addresses, READ_WRITE);
+}
+
+Status KernelProcess::pageFaultRange(VirtualAddress startAddress, PageNum count, AccessType type) {
+	std::vector<VirtualAddress> addresses;
+	VirtualAddress pageAddress = (startAddress / PAGE_SIZE) * PAGE_SIZE;
+	for (PageNum page = 0; page < count; page++) {
+		addresses.push_back(pageAddress + page * PAGE_SIZE);
 	}
-	PhysicalAddress frameAddress = pSystem->takeFromBuddySystem_s(1);
-	if (!frameAddress) {
-		frameAddress = pSystem->ejectPageAndGetFrame_s();
-		pSystem->loadFromPartition_s(pid, pageAddress, frameAddress);
+	return pageFaultRange(addresses, type);
+}
+
+Status KernelProcess::pageFaultRange(const std::vector<VirtualAddress>& addresses, AccessType type) {
+	LatencyTimer timer(&counters.faultLatency);
+	std::vector<VirtualAddress> pages;
+	for (auto address : addresses) {
+		if (!address || (address >= (VirtualAddress)PMT_SIZE * PAGE_SIZE)) {
+			return TRAP;
+		}
+		pages.push_back((address / PAGE_SIZE) * PAGE_SIZE);
 	}
-	pte.frame = (pte_t)frameAddress / PAGE_SIZE;
-	pte.accessed = false;
-	pte.addBits = 0;
-	pte.dirty = false;
-	putPTE(pageAddress, pte);
+	std::sort(pages.begin(), pages.end());
+	pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
 
-	Segment* found = 0;
-	for (auto s : segments) {
-		if ((address >= s.second->startAddress) && (address < s.second->startAddress + s.second->size * PAGE_SIZE)) {
-			found = s.second;
-			break;
+	// the whole range has to be mapped before any of it is brought in
+	std::vector<VirtualAddress> missing, copies;
+	KERNEL_LOCK(lock, _mutex);
+	for (auto page : pages) {
+		PTE pte;
+		getPTE(page, &pte);
+		if (!pte.mapped) {
+			Segment* s = findSegmentForAddress(page);
+			if (!s) {
+				return TRAP;
+			}
+			decodePTE(materializePTE(page, s)->load(), &pte);
+		}
+		if (!pte.frame) {
+			missing.push_back(page);
+		} else if (pte.copyOnWrite && (pte.flags & WRITE) && (type & WRITE)) {
+			// a resident page only faults when it is written to while still shared with a clone,
+			// reading it in ahead of time leaves it shared
+			copies.push_back(page);
 		}
 	}
-	if (!found) {
-		printf("Couldn't find segment to which the virtual address %06lu belongs\n", address);
-		throw std::exception();
+
+	// sequentially advised segments get the pages after the fault brought in along with it,
+	// and the ones well behind it aged out so they are the first to go
+	std::set<VirtualAddress> speculative;
+	for (auto page : missing) {
+		Segment* s = findSegmentForAddress(page);
+		if (!s || (s->advice != ADVICE_SEQUENTIAL)) {
+			continue;
+		}
+		VirtualAddress segmentEnd = s->startAddress + s->size * PAGE_SIZE;
+		for (PageNum i = 1; (i <= READAHEAD_WINDOW) && (page + i * PAGE_SIZE < segmentEnd); i++) {
+			VirtualAddress ahead = page + i * PAGE_SIZE;
+			if (!((materializePTE(ahead, s)->load() >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK)) {
+				speculative.insert(ahead);
+			}
+		}
+		for (PageNum i = READAHEAD_WINDOW + 1; (i <= 2 * READAHEAD_WINDOW) && (page >= s->startAddress + i * PAGE_SIZE); i++) {
+			ageOut(page - i * PAGE_SIZE);
+		}
 	}
-	found->physicalSize++;
+	for (auto page : missing) {
+		speculative.erase(page);
+	}
+	missing.insert(missing.end(), speculative.begin(), speculative.end());
+	std::sort(missing.begin(), missing.end());
+	lock.unlock();
 
-	//PageNum physicalMemory = getTotalPhysicalMemory();
-	//PageNum actualPhysicalMemory = getActualPhysicalMemory();
-	//if (physicalMemory != actualPhysicalMemory) {
-	//	printf("Starting to differ!\n");
-	//}
+	PageNum chunkSize = std::max(pSystem->processVMSpaceSize / FAULT_CHUNK_DIVISOR, (PageNum)1);
+	for (size_t next = 0; next < copies.size();) {
+		std::vector<PhysicalAddress> frames;
+		pSystem->getFramesForFault_s(std::min((PageNum)(copies.size() - next), chunkSize), &frames);
+		std::vector<std::pair<VirtualAddress, PhysicalAddress>> batch;
+		for (auto frame : frames) {
+			batch.push_back(std::make_pair(copies[next++], frame));
+		}
+		copyPages_s(batch);
+	}
+	for (size_t next = 0; next < missing.size();) {
+		std::vector<PhysicalAddress> frames;
+		pSystem->getFramesForFault_s(std::min((PageNum)(missing.size() - next), chunkSize), &frames);
+		std::vector<std::pair<VirtualAddress, PhysicalAddress>> batch;
+		for (auto frame : frames) {
+			batch.push_back(std::make_pair(missing[next++], frame));
+		}
+		loadPages_s(batch, speculative);
+	}
 
-	//printPmtFromAddress(address);
+	//printPmtFromAddress(pages.front());
 	//printSegmentsTop();
 	//printf("Done page fault\n");
 	return OK;
 }
 
+void KernelProcess::loadPages_s(std::vector<std::pair<VirtualAddress, PhysicalAddress>>& pages, std::set<VirtualAddress>& speculative) {
+	KERNEL_LOCK(lock, _mutex);
+	// if a page is still being written out, the partition does not have its contents yet
+	std::vector<std::pair<VirtualAddress, PhysicalAddress>> swappedPages;
+	std::vector<std::pair<const char*, PhysicalAddress>> filledPages;
+	std::set<VirtualAddress> filled;
+	for (auto page : pages) {
+		VirtualAddress pageAddress = page.first;
+		transitDone.wait(lock, [this, pageAddress]() { return !pagesInTransit.count(pageAddress); });
+		pte_t entry = getEntryForAddress(pageAddress)->load();
+		if (!(entry & MASK_MAPPED) || (entry & MASK_SHARED)) {
+			continue;
+		}
+		if (entry & MASK_SWAPPED) {
+			swappedPages.push_back(page);
+			continue;
+		}
+		// pages that were never written out come from the segment's content, if it has any
+		Segment* s = getSegmentForAddress(pageAddress);
+		PageNum offset = (pageAddress - s->startAddress) / PAGE_SIZE;
+		filledPages.push_back(std::make_pair((offset < s->contentSize) ? s->content + offset * PAGE_SIZE : (const char*)0, page.second));
+		filled.insert(pageAddress);
+	}
+	lock.unlock();
+	// frames are recycled, so the pages have to be filled in no matter where the frames came from
+	if (!swappedPages.empty()) {
+		pSystem->loadPagesFromPartition_s(this, swappedPages);
+	}
+	for (auto page : filledPages) {
+		if (page.first) {
+			memcpy(page.second, page.first, PAGE_SIZE);
+		} else {
+			memset(page.second, 0, PAGE_SIZE);
+		}
+	}
+	lock.lock();
+	std::vector<PhysicalAddress> unused;
+	for (auto page : pages) {
+		PTE pte;
+		getPTE(page.first, &pte);
+		if (pte.frame || !pte.mapped || (filled.count(page.first) && pte.swapped)) {
+			// somebody else faulted it in meanwhile, and maybe even wrote it out again, or the segment went away
+			unused.push_back(page.second);
+			continue;
+		}
+		PhysicalAddress frame = page.second;
+		bool major = pte.swapped;
+		if (pte.shared) {
+			// another process may have the page resident already, otherwise it is read in from the segment's cluster
+			SharedMapping mapping = getSharedMapping(page.first, 0);
+			frame = pSystem->mapSharedPage_s(mapping.segment, mapping.page, page.second, &major);
+			if (frame != page.second) {
+				unused.push_back(page.second);
+			}
+		}
+		(major ? counters.majorFaults : counters.minorFaults).add();
+		pte.frame = (pte_t)frame / PAGE_SIZE;
+		// the fault counts as a reference, otherwise the page is the first candidate for eviction,
+		// which is just right for pages read ahead that nobody asked for yet
+		pte.accessed = !speculative.count(page.first);
+		pte.prefetched = !pte.accessed;
+		if (pte.prefetched) {
+			counters.prefetchedPages.add();
+		}
+		pte.addBits = 0;
+		pte.dirty = false;
+		pte.copyOnWrite = false;
+		pte.epoch = pSystem->epoch & PTE_EPOCH_MASK;
+		putPTE(page.first, pte);
+		pSystem->tracer.record(TRACE_FAULT, pid, page.first, frame);
+
+		getSegmentForAddress(page.first)->physicalSize++;
+		physicalMemory++;
+	}
+	lock.unlock();
+	pSystem->giveFramesToBuddySystem_s(unused);
+	pSystem->notifyReclaim_s();
+}
+
+void KernelProcess::copyPages_s(std::vector<std::pair<VirtualAddress, PhysicalAddress>>& pages) {
+	std::vector<PhysicalAddress> unused, cowFrames;
+	KERNEL_LOCK(lock, _mutex);
+	for (auto page : pages) {
+		std::atomic<pte_t>* entry = getEntryForAddress(page.first);
+		pte_t oldEntry = entry->load();
+		pte_t frame = (oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK;
+		if (!frame || !(oldEntry & MASK_COW)) {
+			// evicted or already copied meanwhile
+			unused.push_back(page.second);
+			continue;
+		}
+		PhysicalAddress oldFrame = (PhysicalAddress)(frame * PAGE_SIZE);
+		// nobody can start sharing the frame while we hold our lock, so if the clone has let go of it, it is ours to write
+		bool copy = pSystem->isFrameShared_s(oldFrame);
+		if (copy) {
+			memcpy(page.second, oldFrame, PAGE_SIZE);
+			cowFrames.push_back(oldFrame);
+		} else {
+			unused.push_back(page.second);
+		}
+		PTE pte;
+		do {
+			decodePTE(oldEntry, &pte);
+			if (copy) {
+				pte.frame = (pte_t)page.second / PAGE_SIZE;
+			}
+			pte.copyOnWrite = false;
+		} while (!entry->compare_exchange_weak(oldEntry, encodePTE(pte)));
+		counters.minorFaults.add();
+		pSystem->tracer.record(TRACE_FAULT, pid, page.first, (PhysicalAddress)(pte.frame * PAGE_SIZE));
+	}
+	lock.unlock();
+
+	if (!cowFrames.empty()) {
+		synchronizeAccesses();
+		pSystem->releaseSharedFrames_s(cowFrames, &unused);
+	}
+	pSystem->giveFramesToBuddySystem_s(unused);
+	pSystem->notifyReclaim_s();
+}
+
 PhysicalAddress KernelProcess::getPhysicalAddress(VirtualAddress address) {
 	if (!address) {
 		return 0;
 	}
-	pte_t entry = *getEntryForAddress(address);
-	if (!(entry >> PTE_FRAME_SHIFT) || !(entry & MASK_MAPPED)) {
+	pte_t entry = getEntryForAddress(address)->load();
+	if (!((entry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) || !(entry & MASK_MAPPED)) {
 		return 0;
 	}
-	pte_t frameAddress = (entry >> PTE_FRAME_SHIFT) << PAGE_OFFSET_LENGTH;
+	pte_t frameAddress = ((entry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) << PAGE_OFFSET_LENGTH;
 	unsigned offset = address % PAGE_SIZE;
 	return (PhysicalAddress)(frameAddress + offset);
 }
 
+Status KernelProcess::advise(VirtualAddress startAddress, PageNum count, Advice advice) {
+	if ((startAddress % PAGE_SIZE) || !count) {
+		return TRAP;
+	}
+	VirtualAddress endAddress = startAddress + count * PAGE_SIZE;
+	KERNEL_LOCK(lock, _mutex);
+	// the range has to be covered by segments, with no holes in between
+	std::vector<Segment*> covered;
+	for (VirtualAddress address = startAddress; address < endAddress;) {
+		Segment* s = findSegmentForAddress(address);
+		if (!s) {
+			return TRAP;
+		}
+		if ((advice == ADVICE_DONTNEED) && s->locked) {
+			// pinned pages cannot be dropped, they have to be unlocked first
+			return TRAP;
+		}
+		covered.push_back(s);
+		address = s->startAddress + s->size * PAGE_SIZE;
+	}
+
+	switch (advice) {
+	case ADVICE_NORMAL:
+	case ADVICE_SEQUENTIAL:
+	case ADVICE_RANDOM:
+		// read-ahead is decided per segment, so the advice goes to every segment the range touches
+		for (auto s : covered) {
+			s->advice = advice;
+		}
+		return OK;
+	case ADVICE_WILLNEED:
+		lock.unlock();
+		prefetch(startAddress, count);
+		return OK;
+	case ADVICE_DONTNEED:
+		lock.unlock();
+		return dropPages(startAddress, count);
+	default:
+		return TRAP;
+	}
+}
+
+Status KernelProcess::lockSegment(VirtualAddress startAddress) {
+	KERNEL_LOCK(lock, _mutex);
+	auto s = segments.find(startAddress);
+	if (s == segments.end()) {
+		return TRAP;
+	}
+	Segment* segment = s->second;
+	if (!segment->locked) {
+		if ((pinnedMemory + segment->size > pinQuota) || !pSystem->reservePinnedFrames(segment->size)) {
+			return TRAP;
+		}
+		// pin the entries first, so that nothing faulted in from here on can be evicted again,
+		// the ones not written yet get pinned when they are
+		segment->locked = true;
+		for (auto page : segment->materialized) {
+			pinPTE(startAddress + page * PAGE_SIZE, true);
+		}
+		pinnedMemory += segment->size;
+	}
+	PageNum segmentSize = segment->size;
+	lock.unlock();
+	return pageFaultRange(startAddress, segmentSize);
+}
+
+Status KernelProcess::unlockSegment(VirtualAddress startAddress) {
+	KERNEL_LOCK(lock, _mutex);
+	auto s = segments.find(startAddress);
+	if (s == segments.end()) {
+		return TRAP;
+	}
+	Segment* segment = s->second;
+	if (!segment->locked) {
+		return OK;
+	}
+	for (auto page : segment->materialized) {
+		pinPTE(startAddress + page * PAGE_SIZE, false);
+	}
+	segment->locked = false;
+	pinnedMemory -= segment->size;
+	pSystem->releasePinnedFrames(segment->size);
+	return OK;
+}
+
+Status KernelProcess::suspend_s() {
+	KERNEL_LOCK(lock, _mutex);
+	if (suspended || pinnedMemory) {
+		// pinned pages cannot be swapped out, the segments have to be unlocked first
+		return TRAP;
+	}
+	// whatever eviction or the pre-cleaner is writing out has to land before we take the rest
+	transitDone.wait(lock, [this]() { return pagesInTransit.empty(); });
+	std::vector<std::pair<VirtualAddress, PhysicalAddress>> dirtyPages;
+	std::vector<PhysicalAddress> frames, cowFrames;
+	std::vector<SharedMapping> sharedMappings;
+	suspendedPages.clear();
+	for (auto segment : segments) {
+		Segment* s = segment.second;
+		for (auto page : s->materialized) {
+			VirtualAddress virtualAddress = s->startAddress + page * PAGE_SIZE;
+			std::atomic<pte_t>* entry = getEntryForAddress(virtualAddress);
+			pte_t oldEntry = entry->load();
+			if (!((oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK)) {
+				continue;
+			}
+			PTE pte;
+			bool dirty;
+			do {
+				decodePTE(oldEntry, &pte);
+				dirty = pte.dirty;
+				pte.frame = 0;
+				pte.accessed = false;
+				pte.addBits = 0;
+				pte.dirty = false;
+				pte.copyOnWrite = false;
+				pte.prefetched = false;
+				pte.swapped = pte.swapped || (dirty && !pte.shared);
+			} while (!entry->compare_exchange_weak(oldEntry, encodePTE(pte)));
+			PhysicalAddress physicalAddress = (PhysicalAddress)(((oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) * PAGE_SIZE);
+			s->physicalSize--;
+			physicalMemory--;
+			if (oldEntry & MASK_SHARED) {
+				sharedMappings.push_back(getSharedMapping(virtualAddress, oldEntry));
+			} else {
+				if (dirty) {
+					pagesInTransit.insert(virtualAddress);
+					dirtyPages.push_back(std::make_pair(virtualAddress, physicalAddress));
+				}
+				((oldEntry & MASK_COW) ? cowFrames : frames).push_back(physicalAddress);
+			}
+			suspendedPages.push_back(virtualAddress);
+		}
+	}
+	suspended = true;
+	lock.unlock();
+
+	// segments and their materialized pages are both walked in order, so the dirty pages go out as one sorted batch
+	synchronizeAccesses();
+	if (!dirtyPages.empty()) {
+		pSystem->writePagesToPartition_s(this, dirtyPages);
+		lock.lock();
+		for (auto page : dirtyPages) {
+			pagesInTransit.erase(page.first);
+		}
+		lock.unlock();
+		transitDone.notify_all();
+	}
+	pSystem->unmapSharedPages_s(sharedMappings, &frames);
+	pSystem->releaseSharedFrames_s(cowFrames, &frames);
+	pSystem->giveFramesToBuddySystem_s(frames);
+	return OK;
+}
+
+Status KernelProcess::resume() {
+	std::vector<VirtualAddress> pages;
+	{
+		KERNEL_LOCK(lock, _mutex);
+		if (!suspended) {
+			return TRAP;
+		}
+		suspended = false;
+		pages.swap(suspendedPages);
+		// segments deleted meanwhile took their pages with them
+		pages.erase(std::remove_if(pages.begin(), pages.end(), [this](VirtualAddress page) {
+			return !findSegmentForAddress(page);
+		}), pages.end());
+	}
+	if (pages.empty()) {
+		return OK;
+	}
+	return pageFaultRange(pages, READ);
+}
+
+ProcessStats KernelProcess::getStats() {
+	ProcessStats stats;
+	counters.read(&stats);
+	return stats;
+}
+
+void KernelProcess::releaseFrames_s() {
+	// the process is out of the map, so nothing starts evicting or cleaning its pages anymore,
+	// but a write that started before may still be going
+	KERNEL_LOCK(lock, _mutex);
+	transitDone.wait(lock, [this]() { return pagesInTransit.empty(); });
+	std::vector<PhysicalAddress> frames, cowFrames;
+	std::vector<SharedMapping> sharedMappings;
+	std::vector<SharedSegment*> sharedSegments;
+	for (auto s : segments) {
+		// only the entries that were ever written can be set, the pmt goes back to the pool cleared
+		for (auto page : s.second->materialized) {
+			VirtualAddress address = s.first + page * PAGE_SIZE;
+			pte_t oldEntry = getEntryForAddress(address)->exchange(0);
+			pte_t frame = (oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK;
+			if (frame && (oldEntry & MASK_SHARED)) {
+				sharedMappings.push_back(getSharedMapping(address, oldEntry));
+			} else if (frame) {
+				((oldEntry & MASK_COW) ? cowFrames : frames).push_back((PhysicalAddress)(frame * PAGE_SIZE));
+			}
+		}
+	}
+	for (auto s : segments) {
+		if (s.second->locked) {
+			pSystem->releasePinnedFrames(s.second->size);
+		}
+		if (s.second->shared) {
+			sharedSegments.push_back(s.second->shared);
+		}
+		delete s.second;
+	}
+	segments.clear();
+	physicalMemory = 0;
+	virtualMemory = 0;
+	pinnedMemory = 0;
+	lock.unlock();
+	// one visit to the allocator, which merges the buddies once at the end
+	pSystem->unmapSharedPages_s(sharedMappings, &frames);
+	pSystem->releaseSharedFrames_s(cowFrames, &frames);
+	pSystem->giveFramesToBuddySystem_s(frames);
+	for (auto shared : sharedSegments) {
+		pSystem->detachSharedSegment_s(shared);
+	}
+}
+
+void KernelProcess::cloneFrom_s(KernelProcess* parent) {
+	KERNEL_LOCK(parentLock, parent->_mutex);
+	// whatever is on its way to the partition has to land there before we start sharing the clusters
+	parent->transitDone.wait(parentLock, [parent]() { return parent->pagesInTransit.empty(); });
+	KERNEL_LOCK(lock, _mutex);
+	std::vector<PhysicalAddress> frames;
+	PageNum residentPages = 0;
+	for (PageNum page = 0; page < PMT_SIZE; page++) {
+		pte_t entry = parent->pmt[page].load();
+		if (!(entry & MASK_MAPPED)) {
+			continue;
+		}
+		pte_t frame = (entry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK;
+		if (frame) {
+			residentPages++;
+		}
+		if (frame && (entry & MASK_SHARED)) {
+			// shared segments stay shared, the child is just one more process mapping the page
+			SharedMapping mapping = parent->getSharedMapping(page * PAGE_SIZE, entry);
+			KERNEL_LOCK(sharedLock, mapping.segment->_mutex);
+			mapping.segment->pages[mapping.page].mappings++;
+		} else if (frame) {
+			// from now on neither of us writes to the frame without copying it first
+			while (!(entry & MASK_COW) && !parent->pmt[page].compare_exchange_weak(entry, entry | MASK_COW));
+			entry = entry | MASK_COW;
+			frames.push_back((PhysicalAddress)(frame * PAGE_SIZE));
+		}
+		// pins are not inherited, and the parent's readahead is not the child's to hit
+		pmt[page].store(entry & ~(MASK_PINNED | MASK_PREFETCHED));
+	}
+	pSystem->shareFrames_s(frames);
+	for (auto s : parent->segments) {
+		Segment* segment = new Segment(*s.second);
+		segment->locked = false;
+		segments[s.first] = segment;
+		if (segment->shared) {
+			KERNEL_LOCK(sharedLock, segment->shared->_mutex);
+			segment->shared->attachCount++;
+		}
+	}
+	physicalMemory = residentPages;
+	virtualMemory = parent->virtualMemory.load();
+	// the parent must not write anything out before its clusters are shared, or it could
+	// overwrite one the child still needs in place
+	pSystem->copyPageClusters_s(parent, this);
+	lock.unlock();
+	parentLock.unlock();
+
+	// the parent may still be writing through translations it got before its pages turned copy-on-write
+	parent->synchronizeAccesses();
+}
+
 void KernelProcess::initialize(KernelSystem* pSystem) {
 	this->pSystem = pSystem;
 
 	// init pmt
-	pmt = (pte_t*)pSystem->takeFromPmtPool_s();
+	pmt = (std::atomic<pte_t>*)pSystem->takeFromPmtPool_s();
 	if (!pmt) {
 		printf("Cannot create process %u, no space left in PMT pool\n", this->pid);
 		throw std::exception();
 	}
 	pSystem->printPmtPoolTop();
+	pinQuota = std::max(pSystem->processVMSpaceSize / DEFAULT_PIN_QUOTA_DIVISOR, (PageNum)1);
 }
 
-pte_t* KernelProcess::getEntryForAddress(VirtualAddress address) {
+std::atomic<pte_t>* KernelProcess::getEntryForAddress(VirtualAddress address) {
 	PageNum entryNumber = address / PAGE_SIZE;
 	return &(pmt[entryNumber]);
 }
 
-void KernelProcess::getPTE(VirtualAddress address, PTE* pte) {
-	pte_t entry = *getEntryForAddress(address);
-	pte->frame = entry >> PTE_FRAME_SHIFT;
+void KernelProcess::decodePTE(pte_t entry, PTE* pte) {
+	pte->frame = (entry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK;
 	pte->mapped = entry & MASK_MAPPED;
 	pte->accessed = entry & MASK_ACCESSED;
 	pte->addBits = (entry & MASK_ADD_BITS) >> PTE_ADD_BITS_SHIFT;
 	pte->dirty = entry & MASK_DIRTY;
 	pte->flags = (AccessType)(entry & MASK_FLAGS);
+	pte->epoch = (entry >> PTE_EPOCH_SHIFT) & PTE_EPOCH_MASK;
+	pte->pinned = entry & MASK_PINNED;
+	pte->copyOnWrite = entry & MASK_COW;
+	pte->shared = entry & MASK_SHARED;
+	pte->swapped = entry & MASK_SWAPPED;
+	pte->prefetched = entry & MASK_PREFETCHED;
+}
+
+pte_t KernelProcess::encodePTE(PTE pte) {
+	pte_t entry = pte.frame << PTE_FRAME_SHIFT;
+	if (pte.mapped) entry = entry | MASK_MAPPED;
+	if (pte.accessed) entry = entry | MASK_ACCESSED;
+	entry = (entry & ~MASK_ADD_BITS) | (pte.addBits << PTE_ADD_BITS_SHIFT);
+	if (pte.dirty) entry = entry | MASK_DIRTY;
+	entry = entry | pte.flags;
+	entry = entry | ((pte.epoch & PTE_EPOCH_MASK) << PTE_EPOCH_SHIFT);
+	if (pte.pinned) entry = entry | MASK_PINNED;
+	if (pte.copyOnWrite) entry = entry | MASK_COW;
+	if (pte.shared) entry = entry | MASK_SHARED;
+	if (pte.swapped) entry = entry | MASK_SWAPPED;
+	if (pte.prefetched) entry = entry | MASK_PREFETCHED;
+	return entry;
+}
+
+void KernelProcess::getPTE(VirtualAddress address, PTE* pte) {
+	decodePTE(getEntryForAddress(address)->load(), pte);
 }
 
 void KernelProcess::putPTE(VirtualAddress address, PTE pte) {
-	pte_t* entry = getEntryForAddress(address);
-	*entry = pte.frame << PTE_FRAME_SHIFT;
-	if (pte.mapped) *entry = *entry | MASK_MAPPED;
-	if (pte.accessed) *entry = *entry | MASK_ACCESSED;
-	*entry = (*entry & ~MASK_ADD_BITS) | (pte.addBits << PTE_ADD_BITS_SHIFT);
-	if (pte.dirty) *entry = *entry | MASK_DIRTY;
-	*entry = *entry | pte.flags;
+	// only for entries access cannot touch, the ones without a frame, or while the process is not running
+	getEntryForAddress(address)->store(encodePTE(pte));
+}
+
+void KernelProcess::agePTE(VirtualAddress address) {
+	std::atomic<pte_t>* entry = getEntryForAddress(address);
+	pte_t oldEntry = entry->load();
+	PTE pte;
+	do {
+		decodePTE(oldEntry, &pte);
+		agePTE(&pte);
+	} while (!entry->compare_exchange_weak(oldEntry, encodePTE(pte)));
+}
+
+void KernelProcess::pinPTE(VirtualAddress address, bool pinned) {
+	std::atomic<pte_t>* entry = getEntryForAddress(address);
+	pte_t oldEntry = entry->load();
+	pte_t newEntry;
+	do {
+		newEntry = pinned ? (oldEntry | MASK_PINNED) : (oldEntry & ~MASK_PINNED);
+	} while (!entry->compare_exchange_weak(oldEntry, newEntry));
 }
 
-Status KernelProcess::accessPTE(VirtualAddress address, AccessType type) {
-	pte_t* entry = getEntryForAddress(address);
-	if (!(*entry >> PTE_FRAME_SHIFT) || !(*entry & MASK_MAPPED)) {
-		return PAGE_FAULT;
+Status KernelProcess::accessPTE(VirtualAddress address, AccessType type, PhysicalAddress* physicalAddress) {
+	// a hit takes no lock, it only has to make sure the bits land on the translation it hands out,
+	// eviction swaps the entry with compare-and-swap and so either sees them or makes us fault
+	std::atomic<pte_t>* entry = getEntryForAddress(address);
+	pte_t bits = (type & WRITE) ? (MASK_ACCESSED | MASK_DIRTY) : MASK_ACCESSED;
+	pte_t currentEpoch = pSystem->epoch & PTE_EPOCH_MASK;
+	pte_t oldEntry = entry->load();
+	pte_t newEntry;
+	do {
+		if (!(oldEntry & MASK_MAPPED)) {
+			// the entry is only written on the first fault, until then the segment knows whether the page is there,
+			// and the access is going to fault anyway
+			KERNEL_LOCK(lock, _mutex);
+			Segment* s = findSegmentForAddress(address);
+			return (s && (s->flags & type)) ? PAGE_FAULT : TRAP;
+		}
+		if (!(oldEntry & type)) {
+			// The access type is incorrect
+			return TRAP;
+		}
+		if (!((oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) || ((oldEntry & MASK_COW) && (type & WRITE))) {
+			// The page is not present, or still shared with a clone and about to be written
+			return PAGE_FAULT;
+		}
+		if (((oldEntry & bits) == bits) && !(oldEntry & MASK_PREFETCHED)
+			&& (((oldEntry >> PTE_EPOCH_SHIFT) & PTE_EPOCH_MASK) == currentEpoch)) {
+			// already referenced this tick, and not writing keeps the entry's cache line shared
+			break;
+		}
+		// the first access of a tick folds the ticks before it into the aging bits, so the accessed bit
+		// only ever stands for the tick in the entry's epoch
+		PTE pte;
+		decodePTE(oldEntry, &pte);
+		agePTE(&pte);
+		newEntry = (encodePTE(pte) | bits) & ~MASK_PREFETCHED;
+	} while (!entry->compare_exchange_weak(oldEntry, newEntry));
+	counters.hits.add();
+	if (oldEntry & MASK_PREFETCHED) {
+		counters.prefetchHits.add();
 	}
-	*entry = *entry | MASK_ACCESSED;
-	if (type & WRITE) {
-		*entry = *entry | MASK_DIRTY;
+	if (physicalAddress) {
+		*physicalAddress = (PhysicalAddress)((((oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) << PAGE_OFFSET_LENGTH) + address % PAGE_SIZE);
 	}
 	return OK;
 }
 
-PhysicalAddress KernelProcess::ejectPageAndGetFrame_s() {
-	unsigned minLruDirty = 0x1f8;
+PageNum KernelProcess::ejectPages_s(PageNum count, std::vector<PhysicalAddress>* frames) {
+	KERNEL_LOCK(lock, _mutex);
+	// bring the aging bits of every resident page up to date and line them up starting from the clock hand,
+	// so that out of the pages with the same lru-dirty bits the ones the hand reaches first go out first
+	std::vector<std::pair<unsigned, PageNum>> candidates;
 	for (PageNum i = 0; i < PMT_SIZE; i++) {
-		pte_t* entry = &(pmt[i]);
-		unsigned lruDirty = *entry & MASK_LRU_DIRTY;
-		if ((*entry >> PTE_FRAME_SHIFT) && (lruDirty < minLruDirty)) {
-			minLruDirty = lruDirty;
+		PageNum page = (clockHand + i) % PMT_SIZE;
+		pte_t entry = pmt[page].load();
+		if (!((entry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) || (entry & MASK_PINNED)) {
+			continue;
+		}
+		if (!pagesInTransit.empty() && pagesInTransit.count(page * PAGE_SIZE)) {
+			continue;
 		}
+		agePTE(page * PAGE_SIZE);
+		candidates.push_back(std::make_pair((unsigned)(pmt[page].load() & MASK_LRU_DIRTY), i));
 	}
-	for (PageNum i = 0; i < PMT_SIZE; i++) {
-		pte_t* entry = &(pmt[clockHand]);
-		PageNum prevClockHand = clockHand;
-		clockHand = (clockHand + 1) % PMT_SIZE;
-		// if it has a frame in memory, and the lru-dirty bits match the minimum...
-		if ((*entry >> PTE_FRAME_SHIFT) && ((*entry & MASK_LRU_DIRTY) < minLruDirty)) {
-			printf("wtf");
-		}
-		if ((*entry >> PTE_FRAME_SHIFT) && ((*entry & MASK_LRU_DIRTY) == minLruDirty)) {
-			// ... then we have got our victim!
-			VirtualAddress virtualAddress = prevClockHand * PAGE_SIZE;
-			PTE pte;
-			getPTE(virtualAddress, &pte);
-			PhysicalAddress physicalAddress = (PhysicalAddress)(pte.frame * PAGE_SIZE);
-			if (pte.dirty) {
-				// first write to disk
-				pSystem->writeToPartition(pid, virtualAddress, 1, physicalAddress);
-				pte.dirty = false;
-			}
-			// remove the frame from pmt
+	if (candidates.empty()) {
+		return 0;
+	}
+	if (candidates.size() > count) {
+		std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+		candidates.resize(count);
+	}
+
+	// ... then we have got our victims!
+	std::vector<VirtualAddress> victims;
+	PageNum furthest = 0;
+	for (auto candidate : candidates) {
+		victims.push_back(((clockHand + candidate.second) % PMT_SIZE) * PAGE_SIZE);
+		furthest = std::max(furthest, candidate.second);
+	}
+	clockHand = (clockHand + furthest + 1) % PMT_SIZE;
+	return evictPages(lock, victims, frames);
+}
+
+PageNum KernelProcess::ejectFramesInRange_s(PhysicalAddress startAddress, PhysicalAddress endAddress,
+		std::vector<PhysicalAddress>* frames, PageNum* pinned) {
+	// evicts every page whose frame lies in the range, no matter how recently it was used
+	KERNEL_LOCK(lock, _mutex);
+	std::vector<VirtualAddress> victims;
+	for (PageNum page = 0; page < PMT_SIZE; page++) {
+		pte_t entry = pmt[page].load();
+		PhysicalAddress frame = (PhysicalAddress)(((entry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) * PAGE_SIZE);
+		if (!frame || (frame < startAddress) || (frame >= endAddress)) {
+			continue;
+		}
+		if (entry & MASK_PINNED) {
+			(*pinned)++;
+			continue;
+		}
+		// pages in transit are still being read, the caller comes back for them
+		if (!pagesInTransit.count(page * PAGE_SIZE)) {
+			victims.push_back(page * PAGE_SIZE);
+		}
+	}
+	if (victims.empty()) {
+		return 0;
+	}
+	return evictPages(lock, victims, frames);
+}
+
+PageNum KernelProcess::evictPages(KernelLock& lock, std::vector<VirtualAddress>& victims,
+		std::vector<PhysicalAddress>* frames) {
+	PageNum framesBefore = frames->size();
+	std::vector<std::pair<VirtualAddress, PhysicalAddress>> dirtyPages;
+	std::vector<PhysicalAddress> cowFrames;
+	std::vector<SharedMapping> sharedMappings;
+	for (auto virtualAddress : victims) {
+		// remove the frame from pmt, a write that got in before us shows up in the dirty bit we swap out
+		std::atomic<pte_t>* entry = getEntryForAddress(virtualAddress);
+		pte_t oldEntry = entry->load();
+		PTE pte;
+		bool dirty;
+		do {
+			decodePTE(oldEntry, &pte);
+			dirty = pte.dirty;
 			pte.frame = 0;
 			pte.accessed = false;
 			pte.addBits = 0;
-			putPTE(virtualAddress, pte);
-			// remove the physical space from segment
-			Segment* found = 0;
-			for (auto s : segments) {
-				if ((virtualAddress >= s.second->startAddress) && (virtualAddress < s.second->startAddress + s.second->size * PAGE_SIZE)) {
-					found = s.second;
-					break;
-				}
+			pte.dirty = false;
+			pte.copyOnWrite = false;
+			pte.prefetched = false;
+			pte.swapped = pte.swapped || (dirty && !pte.shared);
+		} while (!entry->compare_exchange_weak(oldEntry, encodePTE(pte)));
+		(dirty ? counters.dirtyEvictions : counters.cleanEvictions).add();
+		PhysicalAddress physicalAddress = (PhysicalAddress)(((oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) * PAGE_SIZE);
+		pSystem->tracer.record(TRACE_EVICTION, pid, virtualAddress, physicalAddress);
+		// remove the physical space from segment
+		getSegmentForAddress(virtualAddress)->physicalSize--;
+		physicalMemory--;
+		if (oldEntry & MASK_SHARED) {
+			// shared pages are written out by whoever lets go of them last, not by us
+			sharedMappings.push_back(getSharedMapping(virtualAddress, oldEntry));
+		} else {
+			if (dirty) {
+				pagesInTransit.insert(virtualAddress);
+				dirtyPages.push_back(std::make_pair(virtualAddress, physicalAddress));
 			}
-			if (!found) {
-				printf("Couldn't find segment to which the virtual address %06lu belongs\n", virtualAddress);
-				throw std::exception();
+			((oldEntry & MASK_COW) ? cowFrames : *frames).push_back(physicalAddress);
+		}
+	}
+	lock.unlock();
+
+	synchronizeAccesses();
+	if (!dirtyPages.empty()) {
+		pSystem->writePagesToPartition_s(this, dirtyPages);
+		lock.lock();
+		for (auto page : dirtyPages) {
+			pagesInTransit.erase(page.first);
+		}
+		lock.unlock();
+		transitDone.notify_all();
+	}
+	// a frame still mapped by a clone or another sharer stays where it is, only the last one out gets it
+	pSystem->unmapSharedPages_s(sharedMappings, frames);
+	pSystem->releaseSharedFrames_s(cowFrames, frames);
+	//printf("Done ejecting pages\n");
+	return frames->size() - framesBefore;
+}
+
+void KernelProcess::prefetch(VirtualAddress startAddress, PageNum count) {
+	{
+		KERNEL_LOCK(lock, _prefetchMutex);
+		pendingPrefetches++;
+	}
+	pSystem->workerPool->submit([this, startAddress, count]() {
+		try {
+			pageFaultRange(startAddress, count, READ);
+		}
+		catch (std::exception&) {
+			// the segment went away before we got to it, there is nothing left to prefetch
+		}
+		// notify under the lock, the process may be gone the moment we let go of it
+		KERNEL_LOCK(lock, _prefetchMutex);
+		pendingPrefetches--;
+		prefetchDone.notify_all();
+	});
+}
+
+Status KernelProcess::dropPages(VirtualAddress startAddress, PageNum count) {
+	// the contents go away without being written out, the next fault on a page finds it zeroed,
+	// or as the segment's content has it; pages of shared segments keep theirs for the other sharers,
+	// we only stop mapping them
+	std::vector<PhysicalAddress> frames, cowFrames;
+	std::vector<SharedMapping> sharedMappings;
+	std::set<VirtualAddress> pages;
+	KERNEL_LOCK(lock, _mutex);
+	for (PageNum page = 0; page < count; page++) {
+		VirtualAddress address = startAddress + page * PAGE_SIZE;
+		transitDone.wait(lock, [this, address]() { return !pagesInTransit.count(address); });
+		std::atomic<pte_t>* entry = getEntryForAddress(address);
+		if (!(entry->load() & MASK_MAPPED)) {
+			// a page never faulted on has nothing to drop, unless loadSegment put it in the partition
+			Segment* s = getSegmentForAddress(address);
+			if ((address - s->startAddress) / PAGE_SIZE >= s->preloadedSize) {
+				continue;
 			}
-			found->physicalSize--;
-			//printf("Done ejecting page\n");
-			return physicalAddress;
+			materializePTE(address, s);
+		}
+		pte_t oldEntry = entry->load();
+		PTE pte;
+		do {
+			decodePTE(oldEntry, &pte);
+			pte.frame = 0;
+			pte.accessed = false;
+			pte.addBits = 0;
+			pte.dirty = false;
+			pte.copyOnWrite = false;
+			pte.prefetched = false;
+			pte.swapped = false;
+		} while (!entry->compare_exchange_weak(oldEntry, encodePTE(pte)));
+		pte_t frame = (oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK;
+		if (frame && (oldEntry & MASK_SHARED)) {
+			sharedMappings.push_back(getSharedMapping(address, oldEntry));
+		} else if (frame) {
+			((oldEntry & MASK_COW) ? cowFrames : frames).push_back((PhysicalAddress)(frame * PAGE_SIZE));
+		}
+		if (frame) {
+			getSegmentForAddress(address)->physicalSize--;
+			physicalMemory--;
+		}
+		if (oldEntry & MASK_SWAPPED) {
+			pages.insert(address);
+		}
+	}
+	lock.unlock();
+
+	synchronizeAccesses();
+	pSystem->unmapSharedPages_s(sharedMappings, &frames);
+	pSystem->releaseSharedFrames_s(cowFrames, &frames);
+	pSystem->giveFramesToBuddySystem_s(frames);
+	if (!pages.empty()) {
+		pSystem->erasePagesFromPartition_s(this, pages);
+	}
+	return OK;
+}
+
+void KernelProcess::ageOut(VirtualAddress address) {
+	// forget the page's history, so that eviction gets to it before anything that is still in use
+	std::atomic<pte_t>* entry = getEntryForAddress(address);
+	pte_t oldEntry = entry->load();
+	PTE pte;
+	do {
+		decodePTE(oldEntry, &pte);
+		if (!pte.frame) {
+			return;
+		}
+		pte.accessed = false;
+		pte.addBits = 0;
+		pte.epoch = pSystem->epoch & PTE_EPOCH_MASK;
+	} while (!entry->compare_exchange_weak(oldEntry, encodePTE(pte)));
+}
+
+SharedMapping KernelProcess::getSharedMapping(VirtualAddress address, pte_t entry) {
+	Segment* s = getSegmentForAddress(address);
+	SharedMapping mapping;
+	mapping.segment = s->shared;
+	mapping.page = (address - s->startAddress) / PAGE_SIZE;
+	mapping.dirty = (entry & MASK_DIRTY) != 0;
+	return mapping;
+}
+
+void KernelProcess::unmapPages(KernelLock& lock, Segment* s, PageNum firstPage, PageNum count,
+		std::vector<PhysicalAddress>* frames, std::vector<PhysicalAddress>* cowFrames,
+		std::vector<SharedMapping>* sharedMappings, std::set<VirtualAddress>* swappedPages) {
+	// the entries are cleared for good, whatever they held is collected for releasePages_s;
+	// pages loadSegment put in the partition have their clusters there even if they were never touched
+	for (PageNum currentPage = firstPage; currentPage < std::min(firstPage + count, s->preloadedSize); currentPage++) {
+		swappedPages->insert(s->startAddress + currentPage * PAGE_SIZE);
+	}
+	PageNum resident = 0;
+	auto first = s->materialized.lower_bound(firstPage), last = s->materialized.lower_bound(firstPage + count);
+	for (auto page = first; page != last; page++) {
+		VirtualAddress currentAddress = s->startAddress + *page * PAGE_SIZE;
+		transitDone.wait(lock, [this, currentAddress]() { return !pagesInTransit.count(currentAddress); });
+		pte_t oldEntry = getEntryForAddress(currentAddress)->exchange(0);
+		pte_t frame = (oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK;
+		if (frame && (oldEntry & MASK_SHARED)) {
+			sharedMappings->push_back(getSharedMapping(currentAddress, oldEntry));
+		} else if (frame) {
+			((oldEntry & MASK_COW) ? cowFrames : frames)->push_back((PhysicalAddress)(frame * PAGE_SIZE));
+		}
+		if (frame) {
+			resident++;
+		}
+		// resident pages may have been written out before as well, only pages that never were have no cluster
+		if (oldEntry & MASK_SWAPPED) {
+			swappedPages->insert(currentAddress);
+		}
+	}
+	s->materialized.erase(first, last);
+	s->physicalSize -= resident;
+	physicalMemory -= resident;
+	virtualMemory -= count;
+}
+
+std::atomic<pte_t>* KernelProcess::materializePTE(VirtualAddress address, Segment* s) {
+	// writes out the entry the segment has stood for so far, the first time the page is faulted on
+	std::atomic<pte_t>* entry = getEntryForAddress(address);
+	if (entry->load() & MASK_MAPPED) {
+		return entry;
+	}
+	PageNum page = (address - s->startAddress) / PAGE_SIZE;
+	PTE pte;
+	decodePTE(0, &pte);
+	pte.mapped = true;
+	pte.flags = s->flags;
+	pte.epoch = pSystem->epoch & PTE_EPOCH_MASK;
+	pte.pinned = s->locked;
+	pte.shared = s->shared != 0;
+	pte.swapped = page < s->preloadedSize;
+	entry->store(encodePTE(pte));
+	s->materialized.insert(page);
+	return entry;
+}
+
+void KernelProcess::releasePages_s(std::vector<PhysicalAddress>& frames, std::vector<PhysicalAddress>& cowFrames,
+		std::vector<SharedMapping>& sharedMappings, std::set<VirtualAddress>& swappedPages) {
+	synchronizeAccesses();
+	pSystem->unmapSharedPages_s(sharedMappings, &frames);
+	pSystem->releaseSharedFrames_s(cowFrames, &frames);
+	pSystem->giveFramesToBuddySystem_s(frames);
+	if (!swappedPages.empty()) {
+		pSystem->erasePagesFromPartition_s(this, swappedPages);
+	}
+}
+
+Segment* KernelProcess::findSegmentForAddress(VirtualAddress address) {
+	auto s = segments.upper_bound(address);
+	if (s != segments.begin()) {
+		s--;
+		if (address < s->second->startAddress + s->second->size * PAGE_SIZE) {
+			return s->second;
 		}
 	}
 	return 0;
 }
 
-PageNum KernelProcess::getTotalPhysicalMemory() {
-	PageNum retVal = 0;
-	for (auto s : segments) {
-		retVal += s.second->physicalSize;
+Segment* KernelProcess::getSegmentForAddress(VirtualAddress address) {
+	Segment* s = findSegmentForAddress(address);
+	if (s) {
+		return s;
 	}
-	return retVal;
+	printf("Couldn't find segment to which the virtual address %06lu belongs\n", address);
+	throw std::exception();
 }
 
-PageNum KernelProcess::getTotalVirtualMemory() {
-	PageNum retVal = 0;
-	for (auto s : segments) {
-		retVal += s.second->size;
+void KernelProcess::periodicJob_s() {
+	{
+		KERNEL_LOCK(lock, _mutex);
+		agePMT();
 	}
-	return retVal;
+	precleanPages_s();
 }
 
-void KernelProcess::shiftLRU() {
-	for (PageNum page = 0; page < PMT_SIZE; page++) {
+void KernelProcess::precleanPages_s() {
+	// write back dirty pages that have gone cold, so that evicting them later does not have to
+	std::vector<std::pair<VirtualAddress, PhysicalAddress>> batch;
+	KERNEL_LOCK(lock, _mutex);
+	for (PageNum i = 0; (i < PRECLEAN_SCAN_LENGTH) && (batch.size() < PRECLEAN_BATCH); i++) {
+		PageNum page = precleanHand;
+		precleanHand = (precleanHand + 1) % PMT_SIZE;
+		pte_t oldEntry = pmt[page].load();
+		if (!((oldEntry >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK) || !(oldEntry & MASK_DIRTY) || (oldEntry & MASK_SHARED)) {
+			continue;
+		}
+		VirtualAddress virtualAddress = page * PAGE_SIZE;
+		if (pagesInTransit.count(virtualAddress)) {
+			continue;
+		}
 		PTE pte;
-		getPTE(page * PAGE_SIZE, &pte);
-		pte.addBits = pte.addBits >> 1;
-		if (pte.accessed) {
-			pte.addBits = pte.addBits | 0x8;
-			pte.accessed = false;
+		bool cold;
+		do {
+			decodePTE(oldEntry, &pte);
+			agePTE(&pte);
+			// clear the dirty bit before writing, so a write that sneaks in meanwhile dirties it again
+			cold = pte.dirty && !pte.accessed && !pte.addBits;
+			if (cold) {
+				pte.dirty = false;
+				pte.swapped = true;
+			}
+		} while (!pmt[page].compare_exchange_weak(oldEntry, encodePTE(pte)));
+		if (cold) {
+			// the page stays in transit so nobody evicts it while we are reading its frame
+			pagesInTransit.insert(virtualAddress);
+			batch.push_back(std::make_pair(virtualAddress, (PhysicalAddress)(pte.frame * PAGE_SIZE)));
+		}
+	}
+	lock.unlock();
+	if (batch.empty()) {
+		return;
+	}
+	synchronizeAccesses();
+	pSystem->writePagesToPartition_s(this, batch);
+	lock.lock();
+	for (auto page : batch) {
+		pagesInTransit.erase(page.first);
+	}
+	lock.unlock();
+	transitDone.notify_all();
+	pSystem->notifyReclaim_s();
+}
+
+unsigned KernelProcess::beginAccess() {
+	unsigned slot = accessSlot;
+	activeAccesses[slot]++;
+	return slot;
+}
+
+void KernelProcess::endAccess(unsigned slot) {
+	activeAccesses[slot]--;
+}
+
+void KernelProcess::synchronizeAccesses() {
+	// waits until nobody uses the translations handed out before the call, which must happen before their frames
+	// are freed, reused or written out; the caller has already unmapped or cleaned the pages, so any access that
+	// starts from now on sees that, and flipping the slot twice waits out everything that may have started before
+	KERNEL_LOCK(lock, _gracePeriodMutex);
+	for (int flip = 0; flip < 2; flip++) {
+		unsigned slot = accessSlot;
+		accessSlot = !slot;
+		while (activeAccesses[slot]) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+// both leave out pinned pages, eviction weighs the process only by what it may take from it
+PageNum KernelProcess::getTotalPhysicalMemory() {
+	PageNum physical = physicalMemory, pinned = pinnedMemory;
+	// a segment that is still being faulted in has fewer resident pages than pinned ones
+	return (physical > pinned) ? physical - pinned : 0;
+}
+
+PageNum KernelProcess::getTotalVirtualMemory() {
+	return virtualMemory - pinnedMemory;
+}
+
+void KernelProcess::agePTE(PTE* pte) {
+	// the accessed bit belongs to the tick of the entry's epoch, the ticks after it up to now saw no access
+	unsigned elapsed = (pSystem->epoch - pte->epoch) & PTE_EPOCH_MASK;
+	if (!elapsed) {
+		return;
+	}
+	uint8_t addBits = (pte->addBits >> 1) | (pte->accessed ? 0x8 : 0);
+	pte->addBits = (elapsed < 5) ? (addBits >> (elapsed - 1)) : 0;
+	pte->accessed = false;
+	pte->epoch = pSystem->epoch & PTE_EPOCH_MASK;
+}
+
+void KernelProcess::agePMT() {
+	// a slice per tick, so that every entry is aged before its truncated epoch can wrap around
+	for (PageNum i = 0; i < AGING_SWEEP_BATCH; i++) {
+		PageNum page = agingHand;
+		agingHand = (agingHand + 1) % PMT_SIZE;
+		if (!((pmt[page].load() >> PTE_FRAME_SHIFT) & PTE_FRAME_MASK)) {
+			continue;
 		}
-		putPTE(page * PAGE_SIZE, pte);
+		agePTE(page * PAGE_SIZE);
 	}
 }
 
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include "vm_declarations.h"
+#include "LockProfiler.h"
+#include "Statistics.h"
 
 class Process;
 class KernelSystem;
@@ -14,27 +19,112 @@ public:
 		AccessType flags);
 	Status loadSegment(VirtualAddress startAddress, PageNum segmentSize,
 		AccessType flags, void* content);
+	Status mapSegment(VirtualAddress startAddress, PageNum segmentSize,
+		AccessType flags, const void* content);
 	Status deleteSegment(VirtualAddress startAddress);
+	Status resizeSegment(VirtualAddress startAddress, PageNum newSize);
+	Status moveSegment(VirtualAddress oldStartAddress, VirtualAddress newStartAddress);
+	Status createSharedSegment(VirtualAddress startAddress, PageNum segmentSize,
+		const char* name, AccessType flags);
+	Status attachSharedSegment(VirtualAddress startAddress, const char* name, AccessType flags);
 	Status pageFault(VirtualAddress address);
+	Status pageFaultRange(VirtualAddress startAddress, PageNum count);
+	Status pageFaultRange(const std::vector<VirtualAddress>& addresses);
 	PhysicalAddress getPhysicalAddress(VirtualAddress address);
+	Status advise(VirtualAddress startAddress, PageNum count, Advice advice);
+	Status lockSegment(VirtualAddress startAddress);
+	Status unlockSegment(VirtualAddress startAddress);
+	Status suspend_s();
+	Status resume();
+	ProcessStats getStats();
 private:
 	ProcessId pid;
 	KernelSystem* pSystem;
 	Process* process;
 
+	// guards the pmt and the segments; access sets the accessed and dirty bits without it,
+	// so entries of resident pages are only ever changed by compare-and-swap
+	std::mutex _mutex;
 	std::map<VirtualAddress, Segment*> segments;
-	pte_t* pmt;
+	std::atomic<pte_t>* pmt;
 	PageNum clockHand = 0;
+	PageNum precleanHand = 0;
+	PageNum agingHand = 0;
+	// pages whose frame is being written out, faults on them wait on transitDone
+	std::set<VirtualAddress> pagesInTransit;
+	KernelCondition transitDone;
+	// kept outside the segments so eviction can weigh processes without taking their locks
+	std::atomic<PageNum> physicalMemory;
+	std::atomic<PageNum> virtualMemory;
+	// pages of locked segments, eviction leaves them out when it weighs the process
+	std::atomic<PageNum> pinnedMemory;
+	PageNum pinQuota = 0;
+	// pages that were resident when the process was suspended, resume brings them back
+	bool suspended = false;
+	std::vector<VirtualAddress> suspendedPages;
+
+	// guards the process's cluster chain in the partition, whose head is cached in repc
+	std::mutex _swapMutex;
+	REPC repc;
+
+	// translations handed out by access stay in use until endAccess, two slots let
+	// synchronizeAccesses wait for the old ones without being starved by new ones
+	std::atomic<unsigned> accessSlot;
+	std::atomic<unsigned long> activeAccesses[2];
+	std::mutex _gracePeriodMutex;
+
+	// prefetches run on the worker pool, the process waits for them before it goes away
+	std::mutex _prefetchMutex;
+	KernelCondition prefetchDone;
+	unsigned pendingPrefetches = 0;
+
+	// bumped without any lock, getStats reads them while the process keeps running
+	ProcessCounters counters;
 
 	void initialize(KernelSystem* pSystem);
-	pte_t* getEntryForAddress(VirtualAddress address);
+	Status createSegment(VirtualAddress startAddress, PageNum segmentSize,
+		AccessType flags, SharedSegment* shared, const char* content, bool swapped);
+	// only faults that may be writes give resident copy-on-write pages frames of their own
+	Status pageFaultRange(VirtualAddress startAddress, PageNum count, AccessType type);
+	Status pageFaultRange(const std::vector<VirtualAddress>& addresses, AccessType type);
+	SharedMapping getSharedMapping(VirtualAddress address, pte_t entry);
+	void unmapPages(KernelLock& lock, Segment* s, PageNum firstPage, PageNum count,
+		std::vector<PhysicalAddress>* frames, std::vector<PhysicalAddress>* cowFrames,
+		std::vector<SharedMapping>* sharedMappings, std::set<VirtualAddress>* swappedPages);
+	void releasePages_s(std::vector<PhysicalAddress>& frames, std::vector<PhysicalAddress>& cowFrames,
+		std::vector<SharedMapping>& sharedMappings, std::set<VirtualAddress>& swappedPages);
+	void releaseFrames_s();
+	void cloneFrom_s(KernelProcess* parent);
+	std::atomic<pte_t>* getEntryForAddress(VirtualAddress address);
+	std::atomic<pte_t>* materializePTE(VirtualAddress address, Segment* s);
+	static void decodePTE(pte_t entry, PTE* pte);
+	static pte_t encodePTE(PTE pte);
 	void getPTE(VirtualAddress address, PTE* pte);
 	void putPTE(VirtualAddress address, PTE pte);
-	Status accessPTE(VirtualAddress address, AccessType type);
-	PhysicalAddress ejectPageAndGetFrame_s();
+	void agePTE(VirtualAddress address);
+	void pinPTE(VirtualAddress address, bool pinned);
+	Status accessPTE(VirtualAddress address, AccessType type, PhysicalAddress* physicalAddress);
+	void loadPages_s(std::vector<std::pair<VirtualAddress, PhysicalAddress>>& pages, std::set<VirtualAddress>& speculative);
+	void copyPages_s(std::vector<std::pair<VirtualAddress, PhysicalAddress>>& pages);
+	void prefetch(VirtualAddress startAddress, PageNum count);
+	Status dropPages(VirtualAddress startAddress, PageNum count);
+	void ageOut(VirtualAddress address);
+	PageNum ejectPages_s(PageNum count, std::vector<PhysicalAddress>* frames);
+	PageNum ejectFramesInRange_s(PhysicalAddress startAddress, PhysicalAddress endAddress,
+		std::vector<PhysicalAddress>* frames, PageNum* pinned);
+	PageNum evictPages(KernelLock& lock, std::vector<VirtualAddress>& victims,
+		std::vector<PhysicalAddress>* frames);
+	Segment* findSegmentForAddress(VirtualAddress address);
+	Segment* getSegmentForAddress(VirtualAddress address);
+	void periodicJob_s();
+	void precleanPages_s();
+	unsigned beginAccess();
+	void endAccess(unsigned slot);
+	void synchronizeAccesses();
 	PageNum getTotalPhysicalMemory();
 	PageNum getTotalVirtualMemory();
-	void shiftLRU();
+	void agePTE(PTE* pte);
+	void agePMT();
 	void printSegmentsTop();
 	void printPmtFromAddress(VirtualAddress address);
 
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include "part.h"
 #include "Process.h"
 #include "KernelProcess.h"
@@ -7,6 +9,23 @@ KernelSystem::KernelSystem(PhysicalAddress processVMSpace, PageNum processVMSpac
 		PhysicalAddress pmtSpace, PageNum pmtSpaceSize,
 		Partition* partition, System* system) {
 	firstEjectHappened = false;
+	epoch = 0;
+	faultCount = 0;
+	pinnedFrameCount = 0;
+	reclaiming = false;
+	totalFaultCount = 0;
+	directReclaimCount = 0;
+	backgroundReclaimCount = 0;
+	rootClusterCount = 1;
+	processClusterCount = 0;
+	pageClusterCount = 0;
+	retiredStats = ProcessStats();
+
+	periodicJobConfig.minTick = DEFAULT_MIN_TICK;
+	periodicJobConfig.maxTick = DEFAULT_MAX_TICK;
+	periodicJobConfig.targetFaultRate = DEFAULT_TARGET_FAULT_RATE;
+	periodicJobConfig.pressureThreshold = DEFAULT_PRESSURE_THRESHOLD;
+	lastTickTime = std::chrono::steady_clock::now();
 
 	if (PAGE_SIZE != ClusterSize) {
 		printf("Cannot start KernelSystem because PAGE_SIZE (%lu) differs from ClusterSize (%lu)\n", PAGE_SIZE, ClusterSize);
@@ -24,10 +43,10 @@ KernelSystem::KernelSystem(PhysicalAddress processVMSpace, PageNum processVMSpac
 	numOfClusters = partition->getNumOfClusters();
 	char buffer[ClusterSize];
 	memset(buffer, 0, ClusterSize);
-	partition->writeCluster(0, buffer);
+	writeCluster(0, buffer);
 	for (ClusterNo c = 1; c < numOfClusters; c++) {
 		*((ClusterNo*)buffer) = (c + 1) % numOfClusters;
-		partition->writeCluster(c, buffer);
+		writeCluster(c, buffer);
 	}
 	freeClusterList = 1;
 
@@ -39,6 +58,7 @@ KernelSystem::KernelSystem(PhysicalAddress processVMSpace, PageNum processVMSpac
 	buddySystem = new BuddySystemLevel[buddySystemLevelCount];
 	memset(processVMSpace, 0, processVMSpaceSize * PAGE_SIZE);
 	giveToBuddySystem(processVMSpace, processVMSpaceSize);
+	memoryRanges.push_back(std::make_pair(processVMSpace, processVMSpaceSize));
 	printBuddySystem();
 
 	// init pmt pool
@@ -50,6 +70,18 @@ KernelSystem::KernelSystem(PhysicalAddress processVMSpace, PageNum processVMSpac
 	}
 	printPmtPoolTop();
 
+	processTableSize = std::max(pmtSpaceSize / (PageNum)SIZE_OF_PMT_IN_PAGES, (PageNum)1);
+	processTable = new std::atomic<KernelProcess*>[processTableSize];
+	for (ProcessId slot = 0; slot < processTableSize; slot++) {
+		processTable[slot] = 0;
+	}
+
+	workerPool = new WorkerPool(std::thread::hardware_concurrency());
+
+	lowWatermark = std::max(processVMSpaceSize / DEFAULT_LOW_WATERMARK_DIVISOR, (PageNum)1);
+	highWatermark = std::max(processVMSpaceSize / DEFAULT_HIGH_WATERMARK_DIVISOR, lowWatermark + 1);
+	reclaimThread = new std::thread(&KernelSystem::reclaimLoop, this);
+
 	// test buddy system
 	//printBuddySystem();
 	//auto firstChunk = takeFromBuddySystem(4096);
@@ -65,76 +97,314 @@ KernelSystem::KernelSystem(PhysicalAddress processVMSpace, PageNum processVMSpac
 }
 
 KernelSystem::~KernelSystem() {
+	{
+		KERNEL_LOCK(lock, _allocatorMutex);
+		stopping = true;
+	}
+	reclaimNeeded.notify_all();
+	reclaimThread->join();
+	delete reclaimThread;
+	delete workerPool;
+	delete[] processTable;
 	delete[] buddySystem;
+	if (LOCK_PROFILING) {
+		printLockProfile();
+	}
 }
 
 Process* KernelSystem::createProcess() {
-	Process* p = new Process(nextPid);
+	KERNEL_LOCK(lock, _processMapMutex);
+	// skip the pids whose slot is taken, a free one turns up within a lap unless every pmt is in use
+	ProcessId pid = nextPid;
+	for (ProcessId tries = 0; processTable[pid % processTableSize]; tries++, pid++) {
+		if (tries == processTableSize) {
+			printf("Cannot create process, every slot in the process table is taken\n");
+			throw std::exception();
+		}
+	}
+	nextPid = pid + 1;
+	Process* p = new Process(pid);
 	p->pProcess->initialize(this);
-	processMap[nextPid] = p;
-	nextPid++;
+	processMap[pid] = p;
+	processTable[pid % processTableSize] = p->pProcess;
 	return p;
 }
 
+Process* KernelSystem::cloneProcess(ProcessId pid) {
+	KernelProcess* parent;
+	{
+		KERNEL_SHARED_LOCK(lock, _processMapMutex);
+		parent = getProcess(pid);
+	}
+	// creating the child needs the map lock exclusively, so we cannot hold on to it; the parent
+	// is gone only once its own thread deletes it, which it does not do while it is being cloned
+	if (!parent) {
+		return 0;
+	}
+	Process* child = createProcess();
+	child->pProcess->cloneFrom_s(parent);
+	return child;
+}
+
 Time KernelSystem::periodicJob() {
-	// TODO: clock algorithm tick (maybe return zero if this part fails), maybe defragment buddy system,
-	// maybe write dirty pages to partition, maybe swap in some absent stuff, maybe swap out if free space is low...
+	// advances the aging epoch, sweeps a slice of every pmt and pre-cleans cold dirty pages of every process,
+	// compacts the buddy system now and then, and works out how long to wait until the next tick
 
-	std::unique_lock<std::mutex> lock(_mutex);
+	KERNEL_LOCK(periodicLock, _periodicMutex);
+	LatencyTimer timer(&agingTickLatency);
+	agingTicks.add();
 
-	for (auto p : processMap) {
-		//p.second->pProcess->printPmtStats();
-		p.second->pProcess->shiftLRU();
+	// aging is done lazily, entries catch up with the epoch on their first access of a tick or when they
+	// are inspected, and a slice of every pmt is swept along each tick
+	Time currentEpoch = ++epoch;
+
+	// every process gets its own task, which only needs that process's lock
+	std::vector<Task> tasks;
+	{
+		KERNEL_SHARED_LOCK(lock, _processMapMutex);
+		for (auto p : processMap) {
+			//p.second->pProcess->printPmtStats();
+			KernelProcess* kp = p.second->pProcess;
+			tasks.push_back([kp]() { kp->periodicJob_s(); });
+		}
+	}
+	if (!(currentEpoch % COMPACTION_PERIOD)) {
+		tasks.push_back([this]() { defragmentBuddySystem_s(); });
 	}
+	workerPool->run(tasks);
+	timer.finish();
+
+	Time nextTick = adaptTickLength();
+	tracer.record(TRACE_TICK, 0, 0, 0, nextTick);
+	return nextTick;
+}
+
+void KernelSystem::setPeriodicJobConfig(PeriodicJobConfig config) {
+	if (!config.minTick || (config.minTick > config.maxTick)) {
+		throw std::exception();
+	}
+	KERNEL_LOCK(periodicLock, _periodicMutex);
+	periodicJobConfig = config;
+	tickLength = std::min(std::max(tickLength, config.minTick), config.maxTick);
+}
+
+PeriodicJobConfig KernelSystem::getPeriodicJobConfig() {
+	KERNEL_LOCK(periodicLock, _periodicMutex);
+	return periodicJobConfig;
+}
+
+std::vector<Time> KernelSystem::getTickHistory() {
+	KERNEL_LOCK(periodicLock, _periodicMutex);
+	return std::vector<Time>(tickHistory.begin(), tickHistory.end());
+}
+
+void KernelSystem::setReclaimWatermarks(PageNum lowWatermark, PageNum highWatermark) {
+	if ((lowWatermark >= highWatermark) || (highWatermark > processVMSpaceSize)) {
+		throw std::exception();
+	}
+	KERNEL_LOCK(lock, _allocatorMutex);
+	this->lowWatermark = lowWatermark;
+	this->highWatermark = highWatermark;
+	if (freeFrameCount < lowWatermark) {
+		reclaimNeeded.notify_one();
+	}
+}
+
+ReclaimStats KernelSystem::getReclaimStats() {
+	ReclaimStats stats;
+	stats.faults = totalFaultCount;
+	stats.directReclaims = directReclaimCount;
+	stats.backgroundReclaims = backgroundReclaimCount;
+	return stats;
+}
+
+SystemStats KernelSystem::getStats() {
+	SystemStats stats;
+	{
+		// the map lock only keeps the processes from going away, their counters are read while they run
+		KERNEL_SHARED_LOCK(lock, _processMapMutex);
+		stats.processes = retiredStats;
+		for (auto p : processMap) {
+			accumulateStats(&stats.processes, p.second->pProcess->getStats());
+		}
+	}
+	stats.clusterReads = clusterReads.read();
+	stats.clusterWrites = clusterWrites.read();
+	stats.buddySplits = buddySplits.read();
+	stats.buddyMerges = buddyMerges.read();
+	stats.agingTicks = agingTicks.read();
+	agingTickLatency.read(&stats.agingTickLatency);
+	partitionReadLatency.read(&stats.partitionReadLatency);
+	partitionWriteLatency.read(&stats.partitionWriteLatency);
+	return stats;
+}
+
+void KernelSystem::printLockProfile() {
+	LockSite::printAll();
+}
 
-	// return the tick length value (should it ever change?)
-	return 1000;
+void KernelSystem::startTrace(unsigned long eventsPerThread) {
+	tracer.start(eventsPerThread);
 }
 
-Status KernelSystem::access(ProcessId pid, VirtualAddress address, AccessType type) {
+void KernelSystem::stopTrace() {
+	tracer.stop();
+}
+
+std::vector<TraceEvent> KernelSystem::getTrace() {
+	return tracer.collect();
+}
+
+Status KernelSystem::writeTrace(const char* path) {
+	return tracer.write(path);
+}
+
+Status KernelSystem::setPinQuota(ProcessId pid, PageNum quota) {
+	// the map lock keeps the process from going away under us
+	KERNEL_SHARED_LOCK(lock, _processMapMutex);
+	KernelProcess* kp = getProcess(pid);
+	if (!kp) {
+		return TRAP;
+	}
+	KERNEL_LOCK(processLock, kp->_mutex);
+	// pages already pinned stay pinned, the quota only holds back further locks
+	kp->pinQuota = quota;
+	return OK;
+}
+
+Status KernelSystem::access(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress* physicalAddress) {
 	if (!address) {
 		// Disallow address zero
 		return TRAP;
 	}
-	ProcessMap::iterator processIter = processMap.find(pid);
-	if (processIter == processMap.end()) {
+	KernelProcess* kp = getProcess(pid);
+	if (!kp) {
 		// The process does not exist
 		return TRAP;
 	}
-	KernelProcess* kp = processIter->second->pProcess;
-	PTE entry;
-	kp->getPTE(address, &entry);
-	if (!entry.mapped || !(entry.flags & type)) {
-		// The page is not mapped, or access type is incorrect
-		return TRAP;
+	if (!tracer.isEnabled()) {
+		return kp->accessPTE(address, type, physicalAddress);
 	}
-	if (!entry.frame) {
-		// The page is not present
-		return PAGE_FAULT;
+	PhysicalAddress translation = 0;
+	Status status = kp->accessPTE(address, type, &translation);
+	tracer.record(TRACE_ACCESS, pid, address, translation, 0, type, status);
+	if (physicalAddress) {
+		*physicalAddress = translation;
 	}
-	kp->accessPTE(address, type);
-	return OK;
+	return status;
+}
+
+Status KernelSystem::accessBatch(ProcessId pid, const AccessRequest* requests, unsigned count,
+		AccessResult* results, std::vector<VirtualAddress>* faultingPages) {
+	KernelProcess* kp = getProcess(pid);
+	Status retVal = OK;
+	for (unsigned i = 0; i < count; i++) {
+		AccessResult* result = &(results[i]);
+		result->physicalAddress = 0;
+		if (!kp || !requests[i].address) {
+			result->status = TRAP;
+		} else {
+			result->status = kp->accessPTE(requests[i].address, requests[i].type, &(result->physicalAddress));
+			tracer.record(TRACE_ACCESS, pid, requests[i].address, result->physicalAddress, 0, requests[i].type, result->status);
+		}
+		if (result->status == TRAP) {
+			retVal = TRAP;
+		} else if (result->status == PAGE_FAULT) {
+			if (retVal == OK) {
+				retVal = PAGE_FAULT;
+			}
+			// instructions have a handful of operands, a linear search beats anything fancier
+			VirtualAddress pageAddress = (requests[i].address / PAGE_SIZE) * PAGE_SIZE;
+			if (faultingPages && (std::find(faultingPages->begin(), faultingPages->end(), pageAddress) == faultingPages->end())) {
+				faultingPages->push_back(pageAddress);
+			}
+		}
+	}
+	return retVal;
+}
+
+unsigned KernelSystem::beginAccess(ProcessId pid) {
+	KernelProcess* kp = getProcess(pid);
+	if (!kp) {
+		return 0;
+	}
+	return kp->beginAccess();
+}
+
+void KernelSystem::endAccess(ProcessId pid, unsigned slot) {
+	KernelProcess* kp = getProcess(pid);
+	if (!kp) {
+		return;
+	}
+	kp->endAccess(slot);
+}
+
+KernelProcess* KernelSystem::getProcess(ProcessId pid) {
+	// the process itself is only ever destroyed by the thread driving it, so it outlives the lookup
+	KernelProcess* kp = processTable[pid % processTableSize];
+	if (!kp || (kp->pid != pid)) {
+		return 0;
+	}
+	return kp;
 }
 
 ClusterNo KernelSystem::getNextFreeCluster() {
 	if (!freeClusterList) {
 		printf("Free cluster list points to zero cluster, which means no free clusters remain!\n");
-		printf("Root clusters: %lu, process clusters: %lu, page clusters: %lu\n", rootClusterCount, processClusterCount, pageClusterCount);
+		printf("Root clusters: %lu, process clusters: %lu, page clusters: %lu\n", rootClusterCount.load(), processClusterCount.load(), pageClusterCount.load());
 		throw std::exception();
 	}
 	ClusterNo nextFreeCluster = freeClusterList;
 	char buffer[ClusterSize];
-	partition->readCluster(freeClusterList, buffer);
+	readCluster(freeClusterList, buffer);
 	freeClusterList = *((ClusterNo*)buffer);
 	//printFreeClustersTop();
 	return nextFreeCluster;
 }
 
+ClusterNo KernelSystem::getNextFreeCluster_s() {
+	KERNEL_LOCK(lock, _swapMutex);
+	return getNextFreeCluster();
+}
+
+void KernelSystem::giveToFreeClusters_s(std::vector<ClusterNo>& clusters) {
+	// clusters still shared with a clone only lose a reference
+	KERNEL_LOCK(lock, _swapMutex);
+	if (!clusterReferences.empty()) {
+		clusters.erase(std::remove_if(clusters.begin(), clusters.end(), [this](ClusterNo cluster) {
+			auto references = clusterReferences.find(cluster);
+			if (references == clusterReferences.end()) {
+				return false;
+			}
+			if (--references->second == 1) {
+				clusterReferences.erase(references);
+			}
+			return true;
+		}), clusters.end());
+	}
+	lock.unlock();
+
+	// chain the clusters up before taking the lock again, so the free list is only held for the last link
+	if (clusters.empty()) {
+		return;
+	}
+	char buffer[ClusterSize];
+	memset(buffer, 0, ClusterSize);
+	for (size_t i = 0; i + 1 < clusters.size(); i++) {
+		*((ClusterNo*)buffer) = clusters[i + 1];
+		writeCluster(clusters[i], buffer);
+	}
+	lock.lock();
+	*((ClusterNo*)buffer) = freeClusterList;
+	writeCluster(clusters.back(), buffer);
+	freeClusterList = clusters.front();
+}
+
 void KernelSystem::getProcessCluster(ProcessId pid, REPC* ret) {
 	ClusterNo prevRootCluster = ret->rootCluster = 0;
 	char rootBuffer[ClusterSize];
 	do {
-		partition->readCluster(ret->rootCluster, rootBuffer);
+		readCluster(ret->rootCluster, rootBuffer);
 		for (ret->rootEntry = 1; ret->rootEntry < ROOT_CLUSTER_ENTRIES; ret->rootEntry++) {
 			RootClusterEntry* entry = (RootClusterEntry*)(rootBuffer + ret->rootEntry * sizeof(RootClusterEntry));
 			if (entry->pid == pid) {
@@ -148,11 +418,11 @@ void KernelSystem::getProcessCluster(ProcessId pid, REPC* ret) {
 				processClusterCount++;
 				char processBuffer[ClusterSize];
 				memset(processBuffer, 0, ClusterSize);
-				partition->writeCluster(ret->processCluster, processBuffer);
+				writeCluster(ret->processCluster, processBuffer);
 
 				entry->pid = pid;
 				entry->processCluster = ret->processCluster;
-				partition->writeCluster(ret->rootCluster, rootBuffer);
+				writeCluster(ret->rootCluster, rootBuffer);
 
 				return;
 			}
@@ -165,27 +435,36 @@ void KernelSystem::getProcessCluster(ProcessId pid, REPC* ret) {
 	ret->rootCluster = getNextFreeCluster();
 	rootClusterCount++;
 	*((ClusterNo*)rootBuffer) = ret->rootCluster;
-	partition->writeCluster(prevRootCluster, rootBuffer);
+	writeCluster(prevRootCluster, rootBuffer);
 
 	ret->processCluster = getNextFreeCluster();
 	processClusterCount++;
 	char processBuffer[ClusterSize];
 	memset(processBuffer, 0, ClusterSize);
-	partition->writeCluster(ret->processCluster, processBuffer);
+	writeCluster(ret->processCluster, processBuffer);
 
 	memset(rootBuffer, 0, ClusterSize);
 	ret->rootEntry = 1;
 	RootClusterEntry* entry = (RootClusterEntry*)(rootBuffer + sizeof(RootClusterEntry));
 	entry->pid = pid;
 	entry->processCluster = ret->processCluster;
-	partition->writeCluster(ret->rootCluster, rootBuffer);
+	writeCluster(ret->rootCluster, rootBuffer);
+}
+
+void KernelSystem::resolveProcessCluster(KernelProcess* kp) {
+	// the process cluster never moves once created, so the root chain only has to be walked once per process
+	if (kp->repc.processCluster) {
+		return;
+	}
+	KERNEL_LOCK(lock, _swapMutex);
+	getProcessCluster(kp->pid, &kp->repc);
 }
 
 void KernelSystem::getPageCluster(ClusterNo processCluster, VirtualAddress address, PEPC* ret) {
 	ClusterNo prevProcessCluster = ret->processCluster = processCluster;
 	char processBuffer[ClusterSize];
 	do {
-		partition->readCluster(ret->processCluster, processBuffer);
+		readCluster(ret->processCluster, processBuffer);
 		for (ret->processEntry = 1; ret->processEntry < PROCESS_CLUSTER_ENTRIES; ret->processEntry++) {
 			ProcessClusterEntry* entry = (ProcessClusterEntry*)(processBuffer + ret->processEntry * sizeof(ProcessClusterEntry));
 			if (entry->address == address) {
@@ -195,15 +474,15 @@ void KernelSystem::getPageCluster(ClusterNo processCluster, VirtualAddress addre
 			}
 			if (entry->address == 0) {
 				// got to the end without finding the pid, create a new page cluster
-				ret->pageCluster = getNextFreeCluster();
+				ret->pageCluster = getNextFreeCluster_s();
 				pageClusterCount++;
 				char pageBuffer[ClusterSize];
 				memset(pageBuffer, 0, ClusterSize);
-				partition->writeCluster(ret->pageCluster, pageBuffer);
+				writeCluster(ret->pageCluster, pageBuffer);
 
 				entry->address = address;
 				entry->pageCluster = ret->pageCluster;
-				partition->writeCluster(ret->processCluster, processBuffer);
+				writeCluster(ret->processCluster, processBuffer);
 
 				return;
 			}
@@ -213,37 +492,46 @@ void KernelSystem::getPageCluster(ClusterNo processCluster, VirtualAddress addre
 	} while (ret->processCluster);
 
 	// got to the end, haven't found it, and need to create a new process cluster first, then new page cluster *sigh*
-	ClusterNo newProcessCluster = getNextFreeCluster();
+	ClusterNo newProcessCluster = getNextFreeCluster_s();
 	processClusterCount++;
 	*((ClusterNo*)processBuffer) = newProcessCluster;
-	partition->writeCluster(prevProcessCluster, processBuffer);
+	writeCluster(prevProcessCluster, processBuffer);
 
-	ret->pageCluster = getNextFreeCluster();
+	ret->pageCluster = getNextFreeCluster_s();
 	pageClusterCount++;
 	char pageBuffer[ClusterSize];
 	memset(pageBuffer, 0, ClusterSize);
-	partition->writeCluster(ret->pageCluster, pageBuffer);
+	writeCluster(ret->pageCluster, pageBuffer);
 
 	memset(processBuffer, 0, ClusterSize);
 	ret->processEntry = 1;
 	ProcessClusterEntry* entry = (ProcessClusterEntry*)(processBuffer + sizeof(ProcessClusterEntry));
 	entry->address = address;
 	entry->pageCluster = ret->pageCluster;
-	partition->writeCluster(newProcessCluster, processBuffer);
+	writeCluster(newProcessCluster, processBuffer);
 }
 
-void KernelSystem::writeToPartition(ProcessId pid, VirtualAddress startAddress, PageNum pageCount, void* content) {
+void KernelSystem::writeToPartition(KernelProcess* kp, VirtualAddress startAddress, PageNum pageCount, void* content) {
 	if (startAddress % PAGE_SIZE) {
 		throw std::exception();
 	}
-	REPC repc;
-	getProcessCluster(pid, &repc);
+	resolveProcessCluster(kp);
 	for (PageNum currentPage = 0; currentPage < pageCount; currentPage++) {
 		VirtualAddress currentAddress = startAddress + currentPage * PAGE_SIZE;
 		PEPC pepc;
-		getPageCluster(repc.processCluster, currentAddress, &pepc);
+		getPageCluster(kp->repc.processCluster, currentAddress, &pepc);
+		if (unshareCluster_s(pepc.pageCluster)) {
+			// the clone keeps the old contents, we write to a cluster of our own
+			pepc.pageCluster = getNextFreeCluster_s();
+			pageClusterCount++;
+			char processBuffer[ClusterSize];
+			readCluster(pepc.processCluster, processBuffer);
+			ProcessClusterEntry* entry = (ProcessClusterEntry*)(processBuffer + pepc.processEntry * sizeof(ProcessClusterEntry));
+			entry->pageCluster = pepc.pageCluster;
+			writeCluster(pepc.processCluster, processBuffer);
+		}
 		char* currentContent = (char*)content + currentPage * PAGE_SIZE;
-		partition->writeCluster(pepc.pageCluster, currentContent);
+		writeCluster(pepc.pageCluster, currentContent);
 	}
 
 	//printRootClusterTop();
@@ -251,47 +539,219 @@ void KernelSystem::writeToPartition(ProcessId pid, VirtualAddress startAddress,
 	//printPageClusterTop(pid, startAddress);
 }
 
-void KernelSystem::writeToPartition_s(ProcessId pid, VirtualAddress startAddress, PageNum pageCount, void* content) {
-	std::unique_lock<std::mutex> lock(_mutex);
-	writeToPartition(pid, startAddress, pageCount, content);
+void KernelSystem::writePagesToPartition_s(KernelProcess* kp, std::vector<std::pair<VirtualAddress, PhysicalAddress>>& pages) {
+	KERNEL_LOCK(lock, kp->_swapMutex);
+	resolveProcessCluster(kp);
+	std::map<VirtualAddress, ClusterNo> pageClusters;
+	for (auto page : pages) {
+		pageClusters[page.first] = 0;
+	}
+	getPageClusters(kp->repc.processCluster, &pageClusters, true);
+	std::vector<std::pair<ClusterNo, const char*>> clusters;
+	for (auto page : pages) {
+		clusters.push_back(std::make_pair(pageClusters[page.first], (const char*)page.second));
+		tracer.record(TRACE_WRITE_BACK, kp->pid, page.first, page.second);
+	}
+	writeClusters(clusters);
 }
 
-void KernelSystem::erasePageFromPartition_s(ProcessId pid, VirtualAddress address) {
-	if (address % PAGE_SIZE) {
-		throw std::exception();
+void KernelSystem::getPageClusters(ClusterNo processCluster, std::map<VirtualAddress, ClusterNo>* pageClusters, bool forWrite) {
+	// one walk down the process cluster chain resolves the whole batch
+	PageNum unresolved = pageClusters->size();
+	char processBuffer[ClusterSize];
+	for (ClusterNo currentCluster = processCluster; currentCluster && unresolved; currentCluster = *((ClusterNo*)processBuffer)) {
+		readCluster(currentCluster, processBuffer);
+		bool changed = false;
+		for (unsigned entryNum = 1; entryNum < PROCESS_CLUSTER_ENTRIES; entryNum++) {
+			ProcessClusterEntry* entry = (ProcessClusterEntry*)(processBuffer + entryNum * sizeof(ProcessClusterEntry));
+			if (!entry->address) {
+				break;
+			}
+			auto page = pageClusters->find(entry->address);
+			if ((page != pageClusters->end()) && !page->second) {
+				if (forWrite && unshareCluster_s(entry->pageCluster)) {
+					// the clone keeps the old contents, we write to a cluster of our own
+					entry->pageCluster = getNextFreeCluster_s();
+					pageClusterCount++;
+					changed = true;
+				}
+				page->second = entry->pageCluster;
+				unresolved--;
+			}
+		}
+		if (changed) {
+			writeCluster(currentCluster, processBuffer);
+		}
 	}
-	std::unique_lock<std::mutex> lock(_mutex);
-	REPC repc;
-	getProcessCluster(pid, &repc);
-	PEPC pepc;
-	getPageCluster(repc.processCluster, address, &pepc);
+	// whatever was not there yet gets its page cluster the usual way
+	for (auto& page : *pageClusters) {
+		if (!page.second) {
+			PEPC pepc;
+			getPageCluster(processCluster, page.first, &pepc);
+			page.second = pepc.pageCluster;
+		}
+	}
+}
 
-	char buffer[ClusterSize];
-	*((ClusterNo*)buffer) = freeClusterList;
-	freeClusterList = pepc.pageCluster;
-	partition->writeCluster(pepc.pageCluster, buffer);
+void KernelSystem::copyPageClusters_s(KernelProcess* from, KernelProcess* to) {
+	// the child starts out with the parent's page clusters, each of which gains a reference
+	std::vector<ProcessClusterEntry> entries;
+	{
+		KERNEL_LOCK(lock, from->_swapMutex);
+		resolveProcessCluster(from);
+		char processBuffer[ClusterSize];
+		for (ClusterNo currentCluster = from->repc.processCluster; currentCluster; currentCluster = *((ClusterNo*)processBuffer)) {
+			readCluster(currentCluster, processBuffer);
+			for (unsigned entryNum = 1; entryNum < PROCESS_CLUSTER_ENTRIES; entryNum++) {
+				ProcessClusterEntry* entry = (ProcessClusterEntry*)(processBuffer + entryNum * sizeof(ProcessClusterEntry));
+				if (!entry->address) {
+					break;
+				}
+				if (entry->address != -1) {
+					entries.push_back(*entry);
+				}
+			}
+		}
+		std::vector<ClusterNo> clusters;
+		for (auto entry : entries) {
+			clusters.push_back(entry.pageCluster);
+		}
+		// share them before letting go of the parent's chain, so it cannot free any of them meanwhile
+		shareClusters_s(clusters);
+	}
 
-	partition->readCluster(pepc.processCluster, buffer);
-	ProcessClusterEntry* entry = (ProcessClusterEntry*)(buffer + pepc.processEntry * sizeof(ProcessClusterEntry));
-	entry->address = -1;
-	partition->writeCluster(pepc.processCluster, buffer);
+	KERNEL_LOCK(lock, to->_swapMutex);
+	resolveProcessCluster(to);
+	ClusterNo currentCluster = to->repc.processCluster;
+	char processBuffer[ClusterSize];
+	memset(processBuffer, 0, ClusterSize);
+	unsigned entryNum = 1;
+	for (auto entry : entries) {
+		if (entryNum == PROCESS_CLUSTER_ENTRIES) {
+			ClusterNo nextCluster = getNextFreeCluster_s();
+			processClusterCount++;
+			*((ClusterNo*)processBuffer) = nextCluster;
+			writeCluster(currentCluster, processBuffer);
+			memset(processBuffer, 0, ClusterSize);
+			currentCluster = nextCluster;
+			entryNum = 1;
+		}
+		*(ProcessClusterEntry*)(processBuffer + entryNum++ * sizeof(ProcessClusterEntry)) = entry;
+	}
+	writeCluster(currentCluster, processBuffer);
+}
 
-	//printRootClusterTop();
-	//printProcessClusterTop(pid);
-	//printPageClusterTop(pid, address);
+void KernelSystem::shareClusters_s(std::vector<ClusterNo>& clusters) {
+	KERNEL_LOCK(lock, _swapMutex);
+	for (auto cluster : clusters) {
+		auto references = clusterReferences.find(cluster);
+		if (references == clusterReferences.end()) {
+			clusterReferences[cluster] = 2;
+		} else {
+			references->second++;
+		}
+	}
 }
 
-void KernelSystem::eraseProcessFromPartition_s(ProcessId pid) {
-	std::unique_lock<std::mutex> lock(_mutex);
-	REPC repc;
-	getProcessCluster(pid, &repc);
+bool KernelSystem::unshareCluster_s(ClusterNo cluster) {
+	// returns whether the cluster was shared, in which case the caller's reference is gone
+	// and it has to move to a cluster of its own before writing
+	KERNEL_LOCK(lock, _swapMutex);
+	auto references = clusterReferences.find(cluster);
+	if (references == clusterReferences.end()) {
+		return false;
+	}
+	if (--references->second == 1) {
+		clusterReferences.erase(references);
+	}
+	return true;
+}
+
+void KernelSystem::writeClusters(std::vector<std::pair<ClusterNo, const char*>>& clusters) {
+	// the partition only takes a cluster at a time, so the best we can do is hand them over in order
+	std::sort(clusters.begin(), clusters.end(), [](const std::pair<ClusterNo, const char*>& a, const std::pair<ClusterNo, const char*>& b) {
+		return a.first < b.first;
+	});
+	for (auto cluster : clusters) {
+		writeCluster(cluster.first, cluster.second);
+	}
+}
+
+void KernelSystem::writeToPartition_s(KernelProcess* kp, VirtualAddress startAddress, PageNum pageCount, void* content) {
+	KERNEL_LOCK(lock, kp->_swapMutex);
+	writeToPartition(kp, startAddress, pageCount, content);
+}
+
+void KernelSystem::erasePagesFromPartition_s(KernelProcess* kp, std::set<VirtualAddress>& pages) {
+	// one walk down the process cluster chain, pages that never made it to the partition are simply not found
+	KERNEL_LOCK(lock, kp->_swapMutex);
+	resolveProcessCluster(kp);
+	std::vector<ClusterNo> freed;
+	char processBuffer[ClusterSize];
+	for (ClusterNo currentCluster = kp->repc.processCluster; currentCluster && (freed.size() < pages.size()); currentCluster = *((ClusterNo*)processBuffer)) {
+		readCluster(currentCluster, processBuffer);
+		bool changed = false;
+		for (unsigned entryNum = 1; entryNum < PROCESS_CLUSTER_ENTRIES; entryNum++) {
+			ProcessClusterEntry* entry = (ProcessClusterEntry*)(processBuffer + entryNum * sizeof(ProcessClusterEntry));
+			if (!entry->address) {
+				break;
+			}
+			if (pages.count(entry->address)) {
+				freed.push_back(entry->pageCluster);
+				entry->address = -1;
+				changed = true;
+			}
+		}
+		if (changed) {
+			writeCluster(currentCluster, processBuffer);
+		}
+	}
+	giveToFreeClusters_s(freed);
+}
+
+void KernelSystem::movePagesInPartition_s(KernelProcess* kp, VirtualAddress oldStartAddress, VirtualAddress newStartAddress, PageNum pageCount) {
+	// the page clusters stay where they are, only the addresses they are filed under change
+	KERNEL_LOCK(lock, kp->_swapMutex);
+	resolveProcessCluster(kp);
+	VirtualAddress oldEnd = oldStartAddress + pageCount * PAGE_SIZE, newEnd = newStartAddress + pageCount * PAGE_SIZE;
+	std::vector<ClusterNo> freed;
+	char processBuffer[ClusterSize];
+	for (ClusterNo currentCluster = kp->repc.processCluster; currentCluster; currentCluster = *((ClusterNo*)processBuffer)) {
+		readCluster(currentCluster, processBuffer);
+		bool changed = false;
+		for (unsigned entryNum = 1; entryNum < PROCESS_CLUSTER_ENTRIES; entryNum++) {
+			ProcessClusterEntry* entry = (ProcessClusterEntry*)(processBuffer + entryNum * sizeof(ProcessClusterEntry));
+			if (!entry->address) {
+				break;
+			}
+			if ((entry->address >= oldStartAddress) && (entry->address < oldEnd)) {
+				entry->address = entry->address - oldStartAddress + newStartAddress;
+				changed = true;
+			} else if ((entry->address >= newStartAddress) && (entry->address < newEnd)) {
+				// whatever was left under the new addresses would shadow the pages moving there
+				freed.push_back(entry->pageCluster);
+				entry->address = -1;
+				changed = true;
+			}
+		}
+		if (changed) {
+			writeCluster(currentCluster, processBuffer);
+		}
+	}
+	giveToFreeClusters_s(freed);
+}
+
+void KernelSystem::eraseProcessFromPartition_s(KernelProcess* kp) {
+	KERNEL_LOCK(lock, kp->_swapMutex);
+	resolveProcessCluster(kp);
+	REPC repc = kp->repc;
 
-	// iterate through and erase the page clusters
+	// iterate through and collect the page clusters, then hand them all back in one go
 	ClusterNo processCluster = repc.processCluster;
 	char processBuffer[ClusterSize];
-	char pageBuffer[ClusterSize];
+	std::vector<ClusterNo> freed;
 	do {
-		partition->readCluster(processCluster, processBuffer);
+		readCluster(processCluster, processBuffer);
 		for (unsigned entryNum = 1; entryNum < PROCESS_CLUSTER_ENTRIES; entryNum++) {
 			ProcessClusterEntry* pce = (ProcessClusterEntry*)(processBuffer + entryNum * sizeof(ProcessClusterEntry));
 			if (!pce->address) {
@@ -300,60 +760,91 @@ void KernelSystem::eraseProcessFromPartition_s(ProcessId pid) {
 			if (pce->address == -1) {
 				continue;
 			}
-			*((ClusterNo*)pageBuffer) = freeClusterList;
-			freeClusterList = pce->pageCluster;
-			partition->writeCluster(pce->pageCluster, pageBuffer);
-		}
-		ClusterNo nextProcessCluster = *((ClusterNo*)processBuffer);
-		*((ClusterNo*)processBuffer) = freeClusterList;
-		partition->writeCluster(processCluster, processBuffer);
-		freeClusterList = processCluster;
-		processCluster = nextProcessCluster;
+			freed.push_back(pce->pageCluster);
+		}
+		freed.push_back(processCluster);
+		processCluster = *((ClusterNo*)processBuffer);
 	} while (processCluster);
+	giveToFreeClusters_s(freed);
+	kp->repc.processCluster = 0;
 
 	// erase the process entry from the root cluster
-	partition->readCluster(repc.rootCluster, processBuffer);
+	KERNEL_LOCK(swapLock, _swapMutex);
+	readCluster(repc.rootCluster, processBuffer);
 	RootClusterEntry* rce = (RootClusterEntry*)(processBuffer + repc.rootEntry * sizeof(RootClusterEntry));
 	rce->pid = -1;
-	partition->writeCluster(repc.rootCluster, processBuffer);
+	writeCluster(repc.rootCluster, processBuffer);
 
 	//printRootClusterTop();
 	//printProcessClusterTop(pid);
 }
 
-void KernelSystem::loadFromPartition_s(ProcessId pid, VirtualAddress virtualAddress, PhysicalAddress physicalAddress) {
-	if (virtualAddress % PAGE_SIZE) {
-		throw std::exception();
+void KernelSystem::loadPagesFromPartition_s(KernelProcess* kp, std::vector<std::pair<VirtualAddress, PhysicalAddress>>& pages) {
+	KERNEL_LOCK(lock, kp->_swapMutex);
+	resolveProcessCluster(kp);
+	std::map<VirtualAddress, ClusterNo> pageClusters;
+	for (auto page : pages) {
+		if (page.first % PAGE_SIZE) {
+			throw std::exception();
+		}
+		pageClusters[page.first] = 0;
 	}
-	std::unique_lock<std::mutex> lock(_mutex);
-	REPC repc;
-	getProcessCluster(pid, &repc);
-	PEPC pepc;
-	getPageCluster(repc.processCluster, virtualAddress, &pepc);
-	partition->readCluster(pepc.pageCluster, (char*)physicalAddress);
+	getPageClusters(kp->repc.processCluster, &pageClusters, false);
+	std::vector<std::pair<ClusterNo, char*>> clusters;
+	for (auto page : pages) {
+		clusters.push_back(std::make_pair(pageClusters[page.first], (char*)page.second));
+	}
+	readClusters(clusters);
+}
 
-	//printRootClusterTop();
-	//printProcessClusterTop(pid);
-	//printPageClusterTop(pid, virtualAddress);
+int KernelSystem::readCluster(ClusterNo cluster, char* buffer) {
+	LatencyTimer timer(&partitionReadLatency);
+	clusterReads.add();
+	return partition->readCluster(cluster, buffer);
 }
 
-PhysicalAddress KernelSystem::ejectPageAndGetFrame_s() {
-	std::unique_lock<std::mutex> lock(_mutex);
+int KernelSystem::writeCluster(ClusterNo cluster, const char* buffer) {
+	LatencyTimer timer(&partitionWriteLatency);
+	clusterWrites.add();
+	return partition->writeCluster(cluster, buffer);
+}
+
+void KernelSystem::readClusters(std::vector<std::pair<ClusterNo, char*>>& clusters) {
+	// same as writing, the closest thing to one big read the partition offers is going through them in order
+	std::sort(clusters.begin(), clusters.end(), [](const std::pair<ClusterNo, char*>& a, const std::pair<ClusterNo, char*>& b) {
+		return a.first < b.first;
+	});
+	for (auto cluster : clusters) {
+		readCluster(cluster.first, cluster.second);
+	}
+}
+
+PageNum KernelSystem::ejectPages_s(PageNum count, std::vector<PhysicalAddress>* frames) {
+	// the allocator stays available while we look for victims and write them out
+	KERNEL_LOCK(evictionLock, _evictionMutex);
+	KERNEL_SHARED_LOCK(lock, _processMapMutex);
+	PageNum ejected = 0;
 
 	// get victim process
 	PageNum totalVirtualMemory = getTotalVirtualMemory();
-	PageNum totalPhysicalMemory = processVMSpaceSize;
+	// compare against the frames actually in use, the reclaimer evicts while some are still free
+	PageNum totalPhysicalMemory = getTotalPhysicalMemory();
 	if (!processClockHand) {
 		processClockHand = 1;
 	}
 	KernelProcess* victimProcess;
 	PageNum processVirtualMemory, processPhysicalMemory;
 	double physicalMemoryRatio, virtualMemoryRatio;
-	for (unsigned i = 0; i < processMap.size(); i++) {
+	// the second time around take whatever we can get, the fair victims may only have pages in transit
+	for (unsigned i = 0; i < 2 * processMap.size(); i++) {
 		// if the process has more of it's total virtual memory mapped to physical frames compared to the average,
 		// force it to eject a page
-		victimProcess = processMap[processClockHand]->pProcess;
-		processClockHand = (processClockHand % processMap.size()) + 1;
+		auto victimIter = processMap.lower_bound(processClockHand);
+		if (victimIter == processMap.end()) {
+			victimIter = processMap.begin();
+		}
+		victimProcess = victimIter->second->pProcess;
+		processClockHand = victimIter->first + 1;
 		processVirtualMemory = victimProcess->getTotalVirtualMemory();
 		processPhysicalMemory = victimProcess->getTotalPhysicalMemory();
 		//PageNum processActualPhysicalMemory = victimProcess->getActualPhysicalMemory();
@@ -364,20 +855,373 @@ PhysicalAddress KernelSystem::ejectPageAndGetFrame_s() {
 
 		physicalMemoryRatio = (double)processPhysicalMemory / totalPhysicalMemory;
 		virtualMemoryRatio = (double)processVirtualMemory / totalVirtualMemory;
-		if (physicalMemoryRatio >= virtualMemoryRatio) {
-			PhysicalAddress frame = victimProcess->ejectPageAndGetFrame_s();
-			if (frame) {
+		if ((physicalMemoryRatio >= virtualMemoryRatio) || (i >= processMap.size())) {
+			// processes only leave the map while holding the eviction lock, so the victim cannot go away;
+			// letting go of the map lets new processes in while the victim is written out
+			lock.unlock();
+			ejected += victimProcess->ejectPages_s(count - ejected, frames);
+			lock.lock();
+			if (ejected) {
 				firstEjectHappened = true;
-				//printf("Done find victim process and eject page\n");
-				return frame;
+				//printf("Done find victim process and eject pages\n");
+			}
+			if (ejected == count) {
+				return ejected;
 			}
 		}
 	}
+	if (ejected) {
+		return ejected;
+	}
 	// we've gone around full circle and not found anything, our math is bad :(
 	//printf("All processes have been checked for victim pages, but none can be ejected\n");
 	throw std::exception();
 }
 
+void KernelSystem::removeProcess_s(ProcessId pid) {
+	// waiting out the periodic job and eviction guarantees that neither still holds on to the process
+	KERNEL_LOCK(periodicLock, _periodicMutex);
+	KERNEL_LOCK(evictionLock, _evictionMutex);
+	KERNEL_LOCK(lock, _processMapMutex);
+	auto p = processMap.find(pid);
+	if (p != processMap.end()) {
+		// what the process did still counts once it is gone
+		accumulateStats(&retiredStats, p->second->pProcess->getStats());
+	}
+	processMap.erase(pid);
+	processTable[pid % processTableSize] = 0;
+}
+
+Time KernelSystem::adaptTickLength() {
+	// the caller may well have slept longer than we asked, so measure the rate against the real time
+	auto now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - lastTickTime).count();
+	lastTickTime = now;
+	double faultRate = elapsed > 0 ? faultCount.exchange(0) / elapsed : 0;
+
+	PageNum freeFrames;
+	{
+		KERNEL_LOCK(lock, _allocatorMutex);
+		freeFrames = freeFrameCount;
+	}
+	bool underPressure = (double)(processVMSpaceSize - freeFrames) / processVMSpaceSize >= periodicJobConfig.pressureThreshold;
+
+	// halve the tick while we are faulting hard on full memory, so aging keeps up with the working set,
+	// and stretch it slowly once things calm down; the gap between the two thresholds keeps it from flapping
+	if (underPressure && (faultRate > periodicJobConfig.targetFaultRate)) {
+		tickLength = tickLength / 2;
+	} else if (!underPressure || (faultRate < periodicJobConfig.targetFaultRate / 2)) {
+		tickLength = tickLength + tickLength / 4 + 1;
+	}
+	tickLength = std::min(std::max(tickLength, periodicJobConfig.minTick), periodicJobConfig.maxTick);
+
+	tickHistory.push_back(tickLength);
+	if (tickHistory.size() > TICK_HISTORY_LENGTH) {
+		tickHistory.pop_front();
+	}
+	return tickLength;
+}
+
+void KernelSystem::reclaimLoop() {
+	KERNEL_LOCK(lock, _allocatorMutex);
+	while (true) {
+		reclaimNeeded.wait(lock, [this]() { return stopping || (freeFrameCount < lowWatermark); });
+		if (stopping) {
+			return;
+		}
+		// eviction takes the locks itself
+		lock.unlock();
+		try {
+			while (true) {
+				PageNum shortfall;
+				{
+					KERNEL_LOCK(checkLock, _allocatorMutex);
+					if (stopping || (freeFrameCount >= highWatermark)) {
+						break;
+					}
+					shortfall = highWatermark - freeFrameCount;
+				}
+				std::vector<PhysicalAddress> frames;
+				ejectPages_s(std::min(shortfall, (PageNum)EVICTION_BATCH), &frames);
+				giveFramesToBuddySystem_s(frames);
+				backgroundReclaimCount += frames.size();
+			}
+		}
+		catch (std::exception&) {
+			// nothing left that can be evicted, wait until the next time we are short on frames
+		}
+		lock.lock();
+		if (freeFrameCount < lowWatermark) {
+			// could not get above the watermark, do not spin on it, faults will reclaim directly meanwhile
+			reclaimNeeded.wait_for(lock, std::chrono::milliseconds(1));
+		}
+	}
+}
+
+void KernelSystem::getFramesForFault_s(PageNum count, std::vector<PhysicalAddress>* frames) {
+	takeFramesFromBuddySystem_s(count, frames);
+	PageNum fromBuddySystem = frames->size();
+	while (frames->size() < count) {
+		// the reclaimer fell behind, so these faults pay for an eviction themselves, and keep the spare frames around
+		std::vector<PhysicalAddress> ejected;
+		try {
+			ejectPages_s(std::max(count - (PageNum)frames->size(), (PageNum)EVICTION_BATCH), &ejected);
+		}
+		catch (std::exception&) {
+			if (!frames->empty()) {
+				// make do with what we have, waiting for more while holding on to these could starve everybody
+				break;
+			}
+			// every resident page is already on its way out, or the frames are held by faults still
+			// reading their pages in; either way they come back shortly
+			std::this_thread::yield();
+			takeFramesFromBuddySystem_s(count, frames);
+			fromBuddySystem = frames->size();
+			continue;
+		}
+		while (!ejected.empty() && (frames->size() < count)) {
+			frames->push_back(ejected.back());
+			ejected.pop_back();
+		}
+		giveFramesToBuddySystem_s(ejected);
+	}
+	faultCount += frames->size();
+	totalFaultCount += frames->size();
+	directReclaimCount += frames->size() - fromBuddySystem;
+}
+
+Status KernelSystem::suspendProcess(ProcessId pid) {
+	KernelProcess* kp;
+	{
+		KERNEL_SHARED_LOCK(lock, _processMapMutex);
+		kp = getProcess(pid);
+	}
+	// writing the pages out takes a while, holding the map lock meanwhile would hold up creating and
+	// removing processes and the periodic job; as with resume, only the process's own thread deletes it
+	if (!kp) {
+		return TRAP;
+	}
+	return kp->suspend_s();
+}
+
+Status KernelSystem::resumeProcess(ProcessId pid) {
+	KernelProcess* kp;
+	{
+		KERNEL_SHARED_LOCK(lock, _processMapMutex);
+		kp = getProcess(pid);
+	}
+	// faulting may evict, and eviction needs the map lock, so resume cannot hold on to it;
+	// the process is gone only once its own thread deletes it, which it does not do while suspended
+	if (!kp) {
+		return TRAP;
+	}
+	return kp->resume();
+}
+
+Status KernelSystem::addPhysicalMemory(PhysicalAddress startAddress, PageNum pageCount) {
+	if (!startAddress || ((uint64_t)startAddress % PAGE_SIZE) || !pageCount) {
+		return TRAP;
+	}
+	PhysicalAddress endAddress = (PhysicalAddress)((uint64_t)startAddress + pageCount * PAGE_SIZE);
+	KERNEL_LOCK(hotplugLock, _hotplugMutex);
+	KERNEL_LOCK(lock, _allocatorMutex);
+	for (auto range : memoryRanges) {
+		if ((range.first < endAddress) && (startAddress < (PhysicalAddress)((uint64_t)range.first + range.second * PAGE_SIZE))) {
+			return TRAP;
+		}
+	}
+	PageNum oldSize = processVMSpaceSize;
+	resizeBuddySystem(oldSize + pageCount);
+	memoryRanges.push_back(std::make_pair(startAddress, pageCount));
+	giveToBuddySystem(startAddress, pageCount);
+	defragmentBuddySystem();
+	processVMSpaceSize = oldSize + pageCount;
+	scaleWatermarks(oldSize, processVMSpaceSize);
+	return OK;
+}
+
+Status KernelSystem::reclaimPhysicalMemory(PageNum pageCount, PhysicalAddress* startAddress) {
+	// the pages come off the top of the range added last, so that what is left of it stays one piece
+	KERNEL_LOCK(hotplugLock, _hotplugMutex);
+	KERNEL_LOCK(lock, _allocatorMutex);
+	auto range = std::prev(memoryRanges.end());
+	if (!pageCount || (pageCount > range->second) || (pageCount >= processVMSpaceSize)
+			|| ((processVMSpaceSize - pageCount) / MAX_PINNED_DIVISOR < pinnedFrameCount)) {
+		return TRAP;
+	}
+	reclaimEnd = (PhysicalAddress)((uint64_t)range->first + range->second * PAGE_SIZE);
+	reclaimStart = (PhysicalAddress)((uint64_t)reclaimEnd - pageCount * PAGE_SIZE);
+	// from here on nothing in the range is handed out, and whatever of it comes back is set aside
+	takeRangeFromBuddySystem(reclaimStart, reclaimEnd);
+	reclaiming = true;
+
+	// the rest is in use, evict it; faults go on meanwhile and only ever get frames from outside the range
+	while (reclaimedFrames.size() < pageCount) {
+		unsigned long events = reclaimEvents;
+		lock.unlock();
+		PageNum pinned = 0;
+		{
+			KERNEL_LOCK(evictionLock, _evictionMutex);
+			std::vector<KernelProcess*> processes;
+			{
+				KERNEL_SHARED_LOCK(mapLock, _processMapMutex);
+				for (auto p : processMap) {
+					processes.push_back(p.second->pProcess);
+				}
+			}
+			// processes only leave the map while holding the eviction lock, so none of them can go away
+			for (auto kp : processes) {
+				std::vector<PhysicalAddress> frames;
+				kp->ejectFramesInRange_s(reclaimStart, reclaimEnd, &frames, &pinned);
+				giveFramesToBuddySystem_s(frames);
+			}
+		}
+		lock.lock();
+		if (pinned) {
+			// a pinned page cannot be moved
+			for (auto frame : reclaimedFrames) {
+				giveToBuddySystem(frame, 1);
+			}
+			defragmentBuddySystem();
+			reclaimedFrames.clear();
+			reclaimStart = reclaimEnd = 0;
+			reclaiming = false;
+			return TRAP;
+		}
+		// whatever the pass could not evict is being written out, cleaned, or read into by a fault,
+		// so wait until some of it is done with instead of going over every process again
+		reclaimProgress.wait(lock, [this, events, pageCount]() {
+			return (reclaimEvents != events) || (reclaimedFrames.size() == pageCount);
+		});
+	}
+	reclaiming = false;
+
+	if (startAddress) {
+		*startAddress = reclaimStart;
+	}
+	if (range->second == pageCount) {
+		memoryRanges.pop_back();
+	} else {
+		range->second -= pageCount;
+	}
+	reclaimedFrames.clear();
+	reclaimStart = reclaimEnd = 0;
+	PageNum oldSize = processVMSpaceSize;
+	processVMSpaceSize = oldSize - pageCount;
+	scaleWatermarks(oldSize, processVMSpaceSize);
+	return OK;
+}
+
+SharedSegment* KernelSystem::createSharedSegment_s(const char* name, PageNum size, AccessType flags) {
+	KERNEL_LOCK(lock, _processMapMutex);
+	if (sharedSegments.count(name)) {
+		return 0;
+	}
+	SharedSegment* shared = new SharedSegment();
+	shared->name = name;
+	shared->flags = flags;
+	shared->pages.resize(size);
+	shared->attachCount = 1;
+	sharedSegments[shared->name] = shared;
+	return shared;
+}
+
+SharedSegment* KernelSystem::attachSharedSegment_s(const char* name) {
+	KERNEL_SHARED_LOCK(lock, _processMapMutex);
+	auto s = sharedSegments.find(name);
+	if (s == sharedSegments.end()) {
+		return 0;
+	}
+	KERNEL_LOCK(sharedLock, s->second->_mutex);
+	s->second->attachCount++;
+	return s->second;
+}
+
+void KernelSystem::detachSharedSegment_s(SharedSegment* shared) {
+	KERNEL_LOCK(lock, _processMapMutex);
+	{
+		KERNEL_LOCK(sharedLock, shared->_mutex);
+		if (--shared->attachCount) {
+			return;
+		}
+	}
+	sharedSegments.erase(shared->name);
+	lock.unlock();
+
+	// nobody maps the pages anymore, all that is left of them are the clusters
+	std::vector<ClusterNo> clusters;
+	for (auto page : shared->pages) {
+		if (page.cluster) {
+			clusters.push_back(page.cluster);
+		}
+	}
+	giveToFreeClusters_s(clusters);
+	delete shared;
+}
+
+PhysicalAddress KernelSystem::mapSharedPage_s(SharedSegment* shared, PageNum page, PhysicalAddress frame, bool* fromPartition) {
+	// returns the frame the page is in, which is the one given only if no other process had it resident
+	KERNEL_LOCK(lock, shared->_mutex);
+	SharedPage* sharedPage = &shared->pages[page];
+	*fromPartition = false;
+	if (!sharedPage->frame) {
+		if (sharedPage->cluster) {
+			readCluster(sharedPage->cluster, (char*)frame);
+			*fromPartition = true;
+		} else {
+			memset(frame, 0, PAGE_SIZE);
+		}
+		sharedPage->frame = frame;
+	}
+	sharedPage->mappings++;
+	return sharedPage->frame;
+}
+
+void KernelSystem::unmapSharedPages_s(std::vector<SharedMapping>& mappings, std::vector<PhysicalAddress>* frames) {
+	// the caller has already waited out its accesses; the last process to let go of a page writes it
+	// back and gets the frame, everybody else just drops the mapping
+	for (auto mapping : mappings) {
+		KERNEL_LOCK(lock, mapping.segment->_mutex);
+		SharedPage* sharedPage = &mapping.segment->pages[mapping.page];
+		sharedPage->dirty = sharedPage->dirty || mapping.dirty;
+		if (--sharedPage->mappings) {
+			continue;
+		}
+		if (sharedPage->dirty) {
+			if (!sharedPage->cluster) {
+				sharedPage->cluster = getNextFreeCluster_s();
+				pageClusterCount++;
+			}
+			writeCluster(sharedPage->cluster, (const char*)sharedPage->frame);
+			sharedPage->dirty = false;
+		}
+		frames->push_back(sharedPage->frame);
+		sharedPage->frame = 0;
+	}
+}
+
+bool KernelSystem::reservePinnedFrames(PageNum count) {
+	PageNum pinned = pinnedFrameCount;
+	do {
+		if (pinned + count > processVMSpaceSize / MAX_PINNED_DIVISOR) {
+			return false;
+		}
+	} while (!pinnedFrameCount.compare_exchange_weak(pinned, pinned + count));
+	return true;
+}
+
+void KernelSystem::releasePinnedFrames(PageNum count) {
+	pinnedFrameCount -= count;
+}
+
+PageNum KernelSystem::getTotalPhysicalMemory() {
+	PageNum retVal = 0;
+	for (auto p : processMap) {
+		retVal += p.second->pProcess->getTotalPhysicalMemory();
+	}
+	return retVal;
+}
+
 PageNum KernelSystem::getTotalVirtualMemory() {
 	PageNum retVal = 0;
 	for (auto p : processMap) {
@@ -392,7 +1236,7 @@ void KernelSystem::printFreeClustersTop() {
 	printf(" | ");
 	ClusterNo currentCluster = freeClusterList;
 	for (int i = 0; i < 5; i++) {
-		partition->readCluster(currentCluster, buffer);
+		readCluster(currentCluster, buffer);
 		printf("%06lu -> ", currentCluster);
 		currentCluster = *((ClusterNo*)buffer);
 		if (!currentCluster) {
@@ -404,7 +1248,7 @@ void KernelSystem::printFreeClustersTop() {
 
 void KernelSystem::printRootClusterTop() {
 	char buffer[ClusterSize];
-	partition->readCluster(0, buffer);
+	readCluster(0, buffer);
 	printf("\n +========== ROOT CLUSTER TOP ==========\n");
 	printf(" | %06lu", *((ClusterNo*)buffer));
 	printf("\n +--------------------------------------\n");
@@ -419,7 +1263,7 @@ void KernelSystem::printProcessClusterTop(ProcessId pid) {
 	REPC repc;
 	getProcessCluster(pid, &repc);
 	char buffer[ClusterSize];
-	partition->readCluster(repc.processCluster, buffer);
+	readCluster(repc.processCluster, buffer);
 	printf("\n +========== PROCESS CLUSTER TOP ==========\n");
 	printf(" | %06lu", *((ClusterNo*)buffer));
 	printf("\n +-----------------------------------------\n");
@@ -436,7 +1280,7 @@ void KernelSystem::printPageClusterTop(ProcessId pid, VirtualAddress address) {
 	PEPC pepc;
 	getPageCluster(repc.processCluster, address, &pepc);
 	char buffer[ClusterSize];
-	partition->readCluster(pepc.pageCluster, buffer);
+	readCluster(pepc.pageCluster, buffer);
 	printf("\n +========== PAGE CLUSTER TOP ==========\n");
 	printf(" | ");
 	for (int i = 0; i < 64; i++) {
@@ -450,38 +1294,176 @@ void KernelSystem::giveToBuddySystem(PhysicalAddress startAddress, PageNum pageC
 	for (PageNum tempBuddySpaceSize = pageCount; tempBuddySpaceSize; tempBuddySpaceSize >>= 1) {
 		if (tempBuddySpaceSize & 1) {
 			buddySystem[currentBuddySystemLevel].insert(startAddress);
+			freeFrameCount += 1 << currentBuddySystemLevel;
 			startAddress = (PhysicalAddress)((uint64_t)startAddress + ((1 << currentBuddySystemLevel) * PAGE_SIZE));
 		}
 		currentBuddySystemLevel++;
 	}
 }
 
-void KernelSystem::giveToBuddySystem_s(PhysicalAddress startAddress, PageNum pageCount) {
-	std::unique_lock<std::mutex> lock(_mutex);
-	giveToBuddySystem(startAddress, pageCount);
+void KernelSystem::giveFramesToBuddySystem_s(std::vector<PhysicalAddress>& frames) {
+	if (frames.empty()) {
+		return;
+	}
+	KERNEL_LOCK(lock, _allocatorMutex);
+	for (auto frame : frames) {
+		if ((frame >= reclaimStart) && (frame < reclaimEnd)) {
+			reclaimedFrames.push_back(frame);
+			reclaimEvents++;
+			continue;
+		}
+		giveToBuddySystem(frame, 1);
+	}
+	defragmentBuddySystem();
+	lock.unlock();
+	if (reclaiming) {
+		reclaimProgress.notify_all();
+	}
+}
+
+void KernelSystem::notifyReclaim_s() {
+	// pages just faulted in or written out may have frames in the range being reclaimed, which the last pass
+	// over the processes could not evict yet
+	if (!reclaiming) {
+		return;
+	}
+	{
+		KERNEL_LOCK(lock, _allocatorMutex);
+		reclaimEvents++;
+	}
+	reclaimProgress.notify_all();
 }
 
-PhysicalAddress KernelSystem::takeFromBuddySystem_s(PageNum pageCount) {
-	std::unique_lock<std::mutex> lock(_mutex);
+void KernelSystem::resizeBuddySystem(PageNum pageCount) {
+	// blocks merge across adjacent ranges, so there has to be a level for all of memory in one piece
+	int levelCount = 0;
+	for (PageNum tempBuddySpaceSize = pageCount; tempBuddySpaceSize; tempBuddySpaceSize >>= 1) {
+		levelCount++;
+	}
+	if (levelCount <= buddySystemLevelCount) {
+		return;
+	}
+	BuddySystem levels = new BuddySystemLevel[levelCount];
+	for (int currentLevel = 0; currentLevel < buddySystemLevelCount; currentLevel++) {
+		levels[currentLevel].swap(buddySystem[currentLevel]);
+	}
+	delete[] buddySystem;
+	buddySystem = levels;
+	buddySystemLevelCount = levelCount;
+}
+
+void KernelSystem::takeRangeFromBuddySystem(PhysicalAddress startAddress, PhysicalAddress endAddress) {
+	// free blocks reaching into the range are split, the part inside is set aside and the rest goes back
+	std::vector<std::pair<PhysicalAddress, PageNum>> overlapping;
+	for (int currentLevel = 0; currentLevel < buddySystemLevelCount; currentLevel++) {
+		BuddySystemLevel* theLevel = &(buddySystem[currentLevel]);
+		for (auto current = theLevel->begin(); current != theLevel->end();) {
+			PhysicalAddress blockEnd = (PhysicalAddress)((uint64_t)*current + (1 << currentLevel) * PAGE_SIZE);
+			if ((*current < endAddress) && (startAddress < blockEnd)) {
+				overlapping.push_back(std::make_pair(*current, (PageNum)1 << currentLevel));
+				freeFrameCount -= 1 << currentLevel;
+				current = theLevel->erase(current);
+			} else {
+				current++;
+			}
+		}
+	}
+	for (auto block : overlapping) {
+		PhysicalAddress blockEnd = (PhysicalAddress)((uint64_t)block.first + block.second * PAGE_SIZE);
+		PhysicalAddress insideStart = std::max(block.first, startAddress), insideEnd = std::min(blockEnd, endAddress);
+		if (block.first < insideStart) {
+			giveToBuddySystem(block.first, ((uint64_t)insideStart - (uint64_t)block.first) / PAGE_SIZE);
+		}
+		if (insideEnd < blockEnd) {
+			giveToBuddySystem(insideEnd, ((uint64_t)blockEnd - (uint64_t)insideEnd) / PAGE_SIZE);
+		}
+		for (PhysicalAddress frame = insideStart; frame < insideEnd; frame = (PhysicalAddress)((uint64_t)frame + PAGE_SIZE)) {
+			reclaimedFrames.push_back(frame);
+		}
+	}
+	defragmentBuddySystem();
+	if (freeFrameCount < lowWatermark) {
+		reclaimNeeded.notify_one();
+	}
+}
+
+void KernelSystem::scaleWatermarks(PageNum oldSize, PageNum newSize) {
+	// watermarks set by hand keep their proportion to memory
+	lowWatermark = std::max(lowWatermark * newSize / oldSize, (PageNum)1);
+	highWatermark = std::min(std::max(highWatermark * newSize / oldSize, lowWatermark + 1), newSize);
+	if (freeFrameCount < lowWatermark) {
+		reclaimNeeded.notify_one();
+	}
+}
+
+void KernelSystem::shareFrames_s(std::vector<PhysicalAddress>& frames) {
+	KERNEL_LOCK(lock, _allocatorMutex);
+	for (auto frame : frames) {
+		auto references = frameReferences.find(frame);
+		if (references == frameReferences.end()) {
+			frameReferences[frame] = 2;
+		} else {
+			references->second++;
+		}
+	}
+}
+
+bool KernelSystem::isFrameShared_s(PhysicalAddress frame) {
+	KERNEL_LOCK(lock, _allocatorMutex);
+	return frameReferences.count(frame) > 0;
+}
+
+void KernelSystem::releaseSharedFrames_s(std::vector<PhysicalAddress>& shared, std::vector<PhysicalAddress>* frames) {
+	// drops the caller's reference to each frame, the ones it held the last reference to are its own now
+	KERNEL_LOCK(lock, _allocatorMutex);
+	for (auto frame : shared) {
+		auto references = frameReferences.find(frame);
+		if (references == frameReferences.end()) {
+			frames->push_back(frame);
+		} else if (--references->second == 1) {
+			frameReferences.erase(references);
+		}
+	}
+}
+
+void KernelSystem::takeFramesFromBuddySystem_s(PageNum count, std::vector<PhysicalAddress>* frames) {
+	KERNEL_LOCK(lock, _allocatorMutex);
+	while (frames->size() < count) {
+		PhysicalAddress frame = takeFromBuddySystem(1);
+		if (!frame) {
+			return;
+		}
+		frames->push_back(frame);
+	}
+}
+
+PhysicalAddress KernelSystem::takeFromBuddySystem(PageNum pageCount) {
 	int currentLevel = 0;
 	for (PageNum tempPageCount = pageCount - 1; tempPageCount; tempPageCount >>= 1) {
 		currentLevel++;
 	}
+	int neededLevel = currentLevel;
 	for (; currentLevel < buddySystemLevelCount; currentLevel++) {
 		BuddySystemLevel *theLevel = &(buddySystem[currentLevel]);
 		if (!theLevel->empty()) {
 			auto first = theLevel->begin();
 			PhysicalAddress oldAddr = *first;
 			theLevel->erase(first);
+			freeFrameCount -= 1 << currentLevel;
 			PhysicalAddress newAddr = (PhysicalAddress)((uint64_t)oldAddr + (pageCount * PAGE_SIZE));
 			PageNum extraSpaceToGiveBack = (1 << currentLevel) - pageCount;
 			if (extraSpaceToGiveBack > 0) {
+				buddySplits.add(currentLevel - neededLevel);
 				giveToBuddySystem(newAddr, extraSpaceToGiveBack);
 				defragmentBuddySystem();
 			}
+			if (freeFrameCount < lowWatermark) {
+				reclaimNeeded.notify_one();
+			}
 			return oldAddr;
 		}
 	}
+	reclaimNeeded.notify_one();
 	return 0;
 }
 
@@ -499,7 +1481,9 @@ void KernelSystem::defragmentBuddySystem() {
 				current++;
 				theLevel->erase(previous);
 				theLevel->erase(temp);
+				freeFrameCount -= 2 << currentLevel;
 				giveToBuddySystem(previousAddr, 2 << currentLevel);
+				buddyMerges.add();
 				previous = theLevel->end();
 			}
 			else {
@@ -512,7 +1496,7 @@ void KernelSystem::defragmentBuddySystem() {
 }
 
 void KernelSystem::defragmentBuddySystem_s() {
-	std::unique_lock<std::mutex> lock(_mutex);
+	KERNEL_LOCK(lock, _allocatorMutex);
 	defragmentBuddySystem();
 }
 
@@ -535,12 +1519,12 @@ void KernelSystem::giveToPmtPool(PhysicalAddress address) {
 }
 
 void KernelSystem::giveToPmtPool_s(PhysicalAddress address) {
-	std::unique_lock<std::mutex> lock(_mutex);
+	KERNEL_LOCK(lock, _allocatorMutex);
 	giveToPmtPool(address);
 }
 
 PhysicalAddress KernelSystem::takeFromPmtPool_s() {
-	std::unique_lock<std::mutex> lock(_mutex);
+	KERNEL_LOCK(lock, _allocatorMutex);
 	if (pmtPool.empty()) {
 		return 0;
 	}
@@ -1,13 +1,36 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
 #include "vm_declarations.h"
+#include "LockProfiler.h"
+#include "Statistics.h"
+#include "Tracer.h"
+#include "WorkerPool.h"
 
 class Partition;
 class System;
 
 typedef std::map<ProcessId, Process*> ProcessMap;
 
+typedef struct SharedSegment {
+	std::string name;
+	AccessType flags;
+	std::vector<SharedPage> pages;
+	// processes that have the segment attached, it is destroyed when the last one deletes it
+	unsigned attachCount;
+	// guards the pages and attachCount
+	std::mutex _mutex;
+} SharedSegment;
+
+typedef std::map<std::string, SharedSegment*> SharedSegmentMap;
+
 class KernelSystem {
 public:
 	KernelSystem(PhysicalAddress processVMSpace, PageNum processVMSpaceSize,
@@ -15,42 +38,160 @@ public:
 		Partition* partition, System* system);
 	~KernelSystem();
 	Process* createProcess();
+	Process* cloneProcess(ProcessId pid);
 	Time periodicJob();
+	void setPeriodicJobConfig(PeriodicJobConfig config);
+	PeriodicJobConfig getPeriodicJobConfig();
+	std::vector<Time> getTickHistory();
+	void setReclaimWatermarks(PageNum lowWatermark, PageNum highWatermark);
+	ReclaimStats getReclaimStats();
+	SystemStats getStats();
+	void printLockProfile();
+	void startTrace(unsigned long eventsPerThread);
+	void stopTrace();
+	std::vector<TraceEvent> getTrace();
+	Status writeTrace(const char* path);
+	Status setPinQuota(ProcessId pid, PageNum quota);
+	Status suspendProcess(ProcessId pid);
+	Status resumeProcess(ProcessId pid);
+	Status addPhysicalMemory(PhysicalAddress startAddress, PageNum pageCount);
+	Status reclaimPhysicalMemory(PageNum pageCount, PhysicalAddress* startAddress);
 	// Hardware job
-	Status access(ProcessId pid, VirtualAddress address, AccessType type);
+	Status access(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress* physicalAddress);
+	Status accessBatch(ProcessId pid, const AccessRequest* requests, unsigned count,
+		AccessResult* results, std::vector<VirtualAddress>* faultingPages);
+	unsigned beginAccess(ProcessId pid);
+	void endAccess(ProcessId pid, unsigned slot);
 
 	static bool firstEjectHappened;
 private:
 	PhysicalAddress processVMSpace;
-	PageNum processVMSpaceSize;
+	// grows and shrinks with addPhysicalMemory and reclaimPhysicalMemory, read without any lock
+	std::atomic<PageNum> processVMSpaceSize;
 	PhysicalAddress pmtSpace;
 	PageNum pmtSpaceSize;
 	Partition* partition;
 	System* system;
 
-	std::mutex _mutex;
+	// lock hierarchy, locks are only ever taken further down the list than the ones already held:
+	//  _hotplugMutex           one change to the size of physical memory at a time
+	//  _periodicMutex          one periodic job at a time
+	//  _evictionMutex          victim selection and the process clock hand
+	//  _processMapMutex        processMap, processTable slots, nextPid and sharedSegments
+	//  KernelProcess::_mutex   the process's pmt, segments and pages in transit
+	//  SharedSegment::_mutex   the shared segment's pages, held while they are read in or written out
+	//  KernelProcess::_swapMutex  the process's cluster chain in the partition
+	//  _swapMutex              the root cluster chain, the free cluster list and clusterReferences
+	//  _allocatorMutex         buddy system, pmt pool, free frame count and frameReferences
+	// cloning is the only place that holds two processes' locks, always the parent's before the child's
+	// faults on different processes only ever meet on the last two, and only briefly
+	std::mutex _hotplugMutex;
+	std::mutex _periodicMutex;
+	std::mutex _evictionMutex;
+	std::shared_timed_mutex _processMapMutex;
+	std::mutex _swapMutex;
+	std::mutex _allocatorMutex;
+	WorkerPool* workerPool;
 	ClusterNo numOfClusters;
 	ClusterNo freeClusterList = 1;
 	BuddySystem buddySystem;
 	int buddySystemLevelCount;
+	PageNum freeFrameCount = 0;
+
+	// background reclaimer, sleeps on reclaimNeeded under _allocatorMutex
+	std::thread* reclaimThread;
+	KernelCondition reclaimNeeded;
+	bool stopping = false;
+	PageNum lowWatermark;
+	PageNum highWatermark;
+	std::atomic<unsigned long> totalFaultCount;
+	std::atomic<unsigned long> directReclaimCount;
+	std::atomic<unsigned long> backgroundReclaimCount;
 	PmtPool pmtPool;
+	// the stretches of memory frames are taken from, in the order they were added, starting with processVMSpace
+	std::vector<std::pair<PhysicalAddress, PageNum>> memoryRanges;
+	// the range reclaimPhysicalMemory is emptying, frames freed in it are set aside instead of going to the buddy system
+	PhysicalAddress reclaimStart = 0;
+	PhysicalAddress reclaimEnd = 0;
+	std::vector<PhysicalAddress> reclaimedFrames;
+	// reclaimPhysicalMemory sleeps on reclaimProgress under _allocatorMutex until reclaimEvents changes, which it does
+	// whenever a frame of the range is set aside, or a frame faulted in or written out may have become evictable
+	std::atomic<bool> reclaiming;
+	KernelCondition reclaimProgress;
+	unsigned long reclaimEvents = 0;
+	// frames and page clusters mapped by more than one process after cloning, with the number of processes
+	// mapping them; anything not in here belongs to a single process
+	std::map<PhysicalAddress, unsigned> frameReferences;
+	std::map<ClusterNo, unsigned> clusterReferences;
 	ProcessMap processMap;
+	SharedSegmentMap sharedSegments;
+	// lookups by pid go through here without any lock, pids are handed out so that no two live processes
+	// share a slot, and there is a pmt for each slot so there are always enough of them
+	std::atomic<KernelProcess*>* processTable;
+	ProcessId processTableSize;
 	ProcessId nextPid = 1;
 	ProcessId processClockHand = 0;
+	std::atomic<Time> epoch;
+	std::atomic<unsigned long> faultCount;
+	// frames pinned by all processes together, kept below processVMSpaceSize / MAX_PINNED_DIVISOR
+	std::atomic<PageNum> pinnedFrameCount;
+
+	PeriodicJobConfig periodicJobConfig;
+	Time tickLength = DEFAULT_TICK;
+	std::deque<Time> tickHistory;
+	std::chrono::steady_clock::time_point lastTickTime;
+
+	std::atomic<ClusterNo> rootClusterCount;
+	std::atomic<ClusterNo> processClusterCount;
+	std::atomic<ClusterNo> pageClusterCount;
 
-	ClusterNo rootClusterCount = 1;
-	ClusterNo processClusterCount = 0;
-	ClusterNo pageClusterCount = 0;
+	// processes that have gone add their counters in here, under _processMapMutex
+	ProcessStats retiredStats;
+	StatCounter clusterReads;
+	StatCounter clusterWrites;
+	StatCounter buddySplits;
+	StatCounter buddyMerges;
+	StatCounter agingTicks;
+	LatencyRecorder agingTickLatency;
+	LatencyRecorder partitionReadLatency;
+	LatencyRecorder partitionWriteLatency;
+	Tracer tracer;
 
 	ClusterNo getNextFreeCluster();
+	ClusterNo getNextFreeCluster_s();
+	void giveToFreeClusters_s(std::vector<ClusterNo>& clusters);
 	void getProcessCluster(ProcessId pid, REPC* ret);
+	void resolveProcessCluster(KernelProcess* kp);
 	void getPageCluster(ClusterNo processCluster, VirtualAddress address, PEPC* ret);
-	void writeToPartition(ProcessId pid, VirtualAddress startAddress, PageNum pageCount, void* content);
-	void writeToPartition_s(ProcessId pid, VirtualAddress startAddress, PageNum pageCount, void* content);
-	void erasePageFromPartition_s(ProcessId pid, VirtualAddress address);
-	void eraseProcessFromPartition_s(ProcessId pid);
-	void loadFromPartition_s(ProcessId pid, VirtualAddress virtualAddress, PhysicalAddress physicalAddress);
-	PhysicalAddress ejectPageAndGetFrame_s();
+	void getPageClusters(ClusterNo processCluster, std::map<VirtualAddress, ClusterNo>* pageClusters, bool forWrite);
+	void copyPageClusters_s(KernelProcess* from, KernelProcess* to);
+	void shareClusters_s(std::vector<ClusterNo>& clusters);
+	bool unshareCluster_s(ClusterNo cluster);
+	void writeClusters(std::vector<std::pair<ClusterNo, const char*>>& clusters);
+	void writeToPartition(KernelProcess* kp, VirtualAddress startAddress, PageNum pageCount, void* content);
+	void writeToPartition_s(KernelProcess* kp, VirtualAddress startAddress, PageNum pageCount, void* content);
+	void writePagesToPartition_s(KernelProcess* kp, std::vector<std::pair<VirtualAddress, PhysicalAddress>>& pages);
+	void erasePagesFromPartition_s(KernelProcess* kp, std::set<VirtualAddress>& pages);
+	void movePagesInPartition_s(KernelProcess* kp, VirtualAddress oldStartAddress, VirtualAddress newStartAddress, PageNum pageCount);
+	void eraseProcessFromPartition_s(KernelProcess* kp);
+	void loadPagesFromPartition_s(KernelProcess* kp, std::vector<std::pair<VirtualAddress, PhysicalAddress>>& pages);
+	void readClusters(std::vector<std::pair<ClusterNo, char*>>& clusters);
+	int readCluster(ClusterNo cluster, char* buffer);
+	int writeCluster(ClusterNo cluster, const char* buffer);
+	KernelProcess* getProcess(ProcessId pid);
+	PageNum ejectPages_s(PageNum count, std::vector<PhysicalAddress>* frames);
+	void removeProcess_s(ProcessId pid);
+	Time adaptTickLength();
+	void reclaimLoop();
+	void getFramesForFault_s(PageNum count, std::vector<PhysicalAddress>* frames);
+	SharedSegment* createSharedSegment_s(const char* name, PageNum size, AccessType flags);
+	SharedSegment* attachSharedSegment_s(const char* name);
+	void detachSharedSegment_s(SharedSegment* shared);
+	PhysicalAddress mapSharedPage_s(SharedSegment* shared, PageNum page, PhysicalAddress frame, bool* fromPartition);
+	void unmapSharedPages_s(std::vector<SharedMapping>& mappings, std::vector<PhysicalAddress>* frames);
+	bool reservePinnedFrames(PageNum count);
+	void releasePinnedFrames(PageNum count);
+	PageNum getTotalPhysicalMemory();
 	PageNum getTotalVirtualMemory();
 	void printFreeClustersTop();
 	void printRootClusterTop();
@@ -58,8 +199,16 @@ private:
 	void printPageClusterTop(ProcessId pid, VirtualAddress address);
 
 	void giveToBuddySystem(PhysicalAddress startAddress, PageNum pageCount);
-	void giveToBuddySystem_s(PhysicalAddress startAddress, PageNum pageCount);
-	PhysicalAddress takeFromBuddySystem_s(PageNum pageCount);
+	void resizeBuddySystem(PageNum pageCount);
+	void takeRangeFromBuddySystem(PhysicalAddress startAddress, PhysicalAddress endAddress);
+	void scaleWatermarks(PageNum oldSize, PageNum newSize);
+	void giveFramesToBuddySystem_s(std::vector<PhysicalAddress>& frames);
+	void notifyReclaim_s();
+	void shareFrames_s(std::vector<PhysicalAddress>& frames);
+	bool isFrameShared_s(PhysicalAddress frame);
+	void releaseSharedFrames_s(std::vector<PhysicalAddress>& shared, std::vector<PhysicalAddress>* frames);
+	PhysicalAddress takeFromBuddySystem(PageNum pageCount);
+	void takeFramesFromBuddySystem_s(PageNum count, std::vector<PhysicalAddress>* frames);
 	void defragmentBuddySystem();
 	void defragmentBuddySystem_s();
 	void printBuddySystem();
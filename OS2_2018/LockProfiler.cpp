@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "LockProfiler.h"
+
+std::atomic<LockSite*> LockSite::sites(0);
+
+LockSite::LockSite(const char* lockName, const char* function) {
+	this->lockName = lockName;
+	this->function = function;
+	// sites are static and never go away, so the list only ever grows at the head
+	next = sites.load();
+	while (!sites.compare_exchange_weak(next, this));
+}
+
+// upper bound of the bucket the given fraction of the histogram's entries falls in, in microseconds
+static unsigned long getPercentile(const LatencyHistogram& histogram, double fraction) {
+	unsigned long wanted = (unsigned long)(histogram.count * fraction);
+	unsigned long seen = 0;
+	for (unsigned bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+		seen += histogram.buckets[bucket];
+		if (seen > wanted) {
+			return 1UL << bucket;
+		}
+	}
+	return 1UL << (LATENCY_BUCKETS - 1);
+}
+
+void LockSite::printAll() {
+	typedef struct SiteSnapshot {
+		LockSite* site;
+		unsigned long acquisitions;
+		unsigned long contentions;
+		LatencyHistogram wait;
+		LatencyHistogram hold;
+	} SiteSnapshot;
+
+	std::vector<SiteSnapshot> snapshots;
+	for (LockSite* site = sites.load(); site; site = site->next) {
+		SiteSnapshot snapshot;
+		snapshot.site = site;
+		snapshot.acquisitions = site->acquisitions.read();
+		snapshot.contentions = site->contentions.read();
+		site->waitTime.read(&snapshot.wait);
+		site->holdTime.read(&snapshot.hold);
+		if (snapshot.acquisitions) {
+			snapshots.push_back(snapshot);
+		}
+	}
+	std::sort(snapshots.begin(), snapshots.end(), [](const SiteSnapshot& a, const SiteSnapshot& b) {
+		if (a.wait.totalMicroseconds != b.wait.totalMicroseconds) {
+			return a.wait.totalMicroseconds > b.wait.totalMicroseconds;
+		}
+		return a.hold.totalMicroseconds > b.hold.totalMicroseconds;
+	});
+
+	printf("\n +========== LOCK PROFILE ==========\n");
+	if (!LOCK_PROFILING) {
+		printf(" | compiled out, build with LOCK_PROFILING set to 1\n");
+	}
+	for (auto snapshot : snapshots) {
+		printf(" | %s in %s\n", snapshot.site->lockName, snapshot.site->function);
+		printf(" |   %lu acquisitions, %lu contended, waited %luus (p50 <%luus, p99 <%luus), held %luus (p50 <%luus, p99 <%luus)\n",
+			snapshot.acquisitions, snapshot.contentions,
+			snapshot.wait.totalMicroseconds, getPercentile(snapshot.wait, 0.5), getPercentile(snapshot.wait, 0.99),
+			snapshot.hold.totalMicroseconds, getPercentile(snapshot.hold, 0.5), getPercentile(snapshot.hold, 0.99));
+	}
+	printf(" +---------------------------\n");
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+#include "vm_declarations.h"
+#include "Statistics.h"
+
+// One place in the code that takes a lock, with what its acquisitions came to so far.
+// There is one static instance per call site, for the whole program rather than per system.
+class LockSite {
+public:
+	LockSite(const char* lockName, const char* function);
+	const char* lockName;
+	const char* function;
+	StatCounter acquisitions;
+	// acquisitions that found the lock taken and had to wait for it
+	StatCounter contentions;
+	LatencyRecorder waitTime;
+	LatencyRecorder holdTime;
+
+	// every site that has taken its lock at least once, the ones that waited longest in total first
+	static void printAll();
+private:
+	LockSite* next;
+	static std::atomic<LockSite*> sites;
+};
+
+#if LOCK_PROFILING
+
+// Stands in for the mutex at one call site, so the lock can be relocked, also by a condition variable,
+// and still be counted against the site that declared it
+template <class Mutex>
+class ProfiledLockable {
+public:
+	ProfiledLockable(Mutex& mutex, LockSite* site) : mutex(mutex), site(site) {}
+
+	void lock() {
+		if (!mutex.try_lock()) {
+			waited(lockTimed([this]() { mutex.lock(); }));
+		} else {
+			waited(std::chrono::steady_clock::duration::zero());
+		}
+	}
+
+	bool try_lock() {
+		if (!mutex.try_lock()) {
+			return false;
+		}
+		waited(std::chrono::steady_clock::duration::zero());
+		return true;
+	}
+
+	void unlock() {
+		site->holdTime.record(std::chrono::steady_clock::now() - acquiredAt);
+		mutex.unlock();
+	}
+
+	void lock_shared() {
+		if (!mutex.try_lock_shared()) {
+			waited(lockTimed([this]() { mutex.lock_shared(); }));
+		} else {
+			waited(std::chrono::steady_clock::duration::zero());
+		}
+	}
+
+	void unlock_shared() {
+		site->holdTime.record(std::chrono::steady_clock::now() - acquiredAt);
+		mutex.unlock_shared();
+	}
+private:
+	Mutex& mutex;
+	LockSite* site;
+	std::chrono::steady_clock::time_point acquiredAt;
+
+	template <class Lock>
+	std::chrono::steady_clock::duration lockTimed(Lock lock) {
+		auto start = std::chrono::steady_clock::now();
+		lock();
+		site->contentions.add();
+		return std::chrono::steady_clock::now() - start;
+	}
+
+	void waited(std::chrono::steady_clock::duration wait) {
+		site->acquisitions.add();
+		site->waitTime.record(wait);
+		acquiredAt = std::chrono::steady_clock::now();
+	}
+};
+
+typedef std::unique_lock<ProfiledLockable<std::mutex>> KernelLock;
+typedef std::condition_variable_any KernelCondition;
+
+#define KERNEL_LOCK(lock, mutex) \
+	static LockSite lock##Site(#mutex, __FUNCTION__); \
+	ProfiledLockable<std::remove_reference<decltype(mutex)>::type> lock##Lockable(mutex, &lock##Site); \
+	std::unique_lock<decltype(lock##Lockable)> lock(lock##Lockable)
+#define KERNEL_SHARED_LOCK(lock, mutex) \
+	static LockSite lock##Site(#mutex, __FUNCTION__); \
+	ProfiledLockable<std::remove_reference<decltype(mutex)>::type> lock##Lockable(mutex, &lock##Site); \
+	std::shared_lock<decltype(lock##Lockable)> lock(lock##Lockable)
+
+#else
+
+// compiled out, the kernel's locks are the plain standard ones
+typedef std::unique_lock<std::mutex> KernelLock;
+typedef std::condition_variable KernelCondition;
+
+#define KERNEL_LOCK(lock, mutex) std::unique_lock<std::remove_reference<decltype(mutex)>::type> lock(mutex)
+#define KERNEL_SHARED_LOCK(lock, mutex) std::shared_lock<std::remove_reference<decltype(mutex)>::type> lock(mutex)
+
+#endif
@@ -23,14 +23,60 @@ Status Process::loadSegment(VirtualAddress startAddress, PageNum segmentSize,
 	return pProcess->loadSegment(startAddress, segmentSize, flags, content);
 }
 
+Status Process::mapSegment(VirtualAddress startAddress, PageNum segmentSize,
+		AccessType flags, const void* content) {
+	return pProcess->mapSegment(startAddress, segmentSize, flags, content);
+}
+
 Status Process::deleteSegment(VirtualAddress startAddress) {
 	return pProcess->deleteSegment(startAddress);
 }
 
+Status Process::resizeSegment(VirtualAddress startAddress, PageNum newSize) {
+	return pProcess->resizeSegment(startAddress, newSize);
+}
+
+Status Process::moveSegment(VirtualAddress oldStartAddress, VirtualAddress newStartAddress) {
+	return pProcess->moveSegment(oldStartAddress, newStartAddress);
+}
+
+Status Process::createSharedSegment(VirtualAddress startAddress, PageNum segmentSize,
+		const char* name, AccessType flags) {
+	return pProcess->createSharedSegment(startAddress, segmentSize, name, flags);
+}
+
+Status Process::attachSharedSegment(VirtualAddress startAddress, const char* name, AccessType flags) {
+	return pProcess->attachSharedSegment(startAddress, name, flags);
+}
+
 Status Process::pageFault(VirtualAddress address) {
 	return pProcess->pageFault(address);
 }
 
+Status Process::pageFaultRange(VirtualAddress startAddress, PageNum count) {
+	return pProcess->pageFaultRange(startAddress, count);
+}
+
+Status Process::pageFaultRange(const std::vector<VirtualAddress>& addresses) {
+	return pProcess->pageFaultRange(addresses);
+}
+
 PhysicalAddress Process::getPhysicalAddress(VirtualAddress address) {
 	return pProcess->getPhysicalAddress(address);
 }
+
+Status Process::advise(VirtualAddress startAddress, PageNum count, Advice advice) {
+	return pProcess->advise(startAddress, count, advice);
+}
+
+Status Process::lockSegment(VirtualAddress startAddress) {
+	return pProcess->lockSegment(startAddress);
+}
+
+Status Process::unlockSegment(VirtualAddress startAddress) {
+	return pProcess->unlockSegment(startAddress);
+}
+
+ProcessStats Process::getStats() {
+	return pProcess->getStats();
+}
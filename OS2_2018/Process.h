@@ -15,9 +15,35 @@ public:
 		AccessType flags);
 	Status loadSegment(VirtualAddress startAddress, PageNum segmentSize,
 		AccessType flags, void* content);
+	// Same as loadSegment, except that nothing is copied up front: pages are filled from the content on first fault,
+	// and only reach the partition once written to and evicted. The content has to outlive the segment;
+	// for a file, map it into memory and pass the view
+	Status mapSegment(VirtualAddress startAddress, PageNum segmentSize,
+		AccessType flags, const void* content);
 	Status deleteSegment(VirtualAddress startAddress);
+	// Grows or shrinks the segment in place; pages past the new end are dropped, and new ones start out zeroed
+	Status resizeSegment(VirtualAddress startAddress, PageNum newSize);
+	// Moves the segment to another address, taking its pages along without copying them
+	Status moveSegment(VirtualAddress oldStartAddress, VirtualAddress newStartAddress);
+	// Creates a segment whose pages are shared with every process that attaches it by name;
+	// it goes away once the last of them deletes it
+	Status createSharedSegment(VirtualAddress startAddress, PageNum segmentSize,
+		const char* name, AccessType flags);
+	// Maps an existing shared segment, with at most the access the creator gave it
+	Status attachSharedSegment(VirtualAddress startAddress, const char* name, AccessType flags);
 	Status pageFault(VirtualAddress address);
+	// Brings in every page of the range that is not resident yet, reading them from the partition in one go
+	Status pageFaultRange(VirtualAddress startAddress, PageNum count);
+	Status pageFaultRange(const std::vector<VirtualAddress>& addresses);
 	PhysicalAddress getPhysicalAddress(VirtualAddress address);
+	// Tells the kernel how a range of mapped pages is going to be used, see Advice
+	Status advise(VirtualAddress startAddress, PageNum count, Advice advice);
+	// Pins every page of the segment in memory, faulting in the ones that are not resident yet;
+	// fails if that would take the process over its pin quota
+	Status lockSegment(VirtualAddress startAddress);
+	Status unlockSegment(VirtualAddress startAddress);
+	// Counts of what the process's accesses and faults came to so far, taken without stopping it
+	ProcessStats getStats();
 private:
 	KernelProcess *pProcess;
 	friend class System;
@@ -185,15 +185,16 @@ ProcessTest::getSegmentInfo(VirtualAddress address) {
     return segment;
 }
 
-void ProcessTest::checkValue(VirtualAddress address, char value) {
+void ProcessTest::checkValue(VirtualAddress address, char expectedValue, char value) {
     std::tuple<MemoryBackup, VirtualAddress, PageNum> segment = getSegmentInfo(address);
     MemoryBackup &backup = std::get<0>(segment);
 
     VirtualAddress begin = std::get<1>(segment);
     VirtualAddress offset = address - begin;
 
+    // the backup already holds what later operands of the instruction write, so the operand says what to expect
     if (backup.second[offset]) {
-        assert(backup.first[offset] == value);
+        assert(expectedValue == value);
     }
 }
 
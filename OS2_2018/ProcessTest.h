@@ -1,6 +1,7 @@
 #ifndef VM_PROCESSTEST_H
 #define VM_PROCESSTEST_H
 
+#include <atomic>
 #include <thread>
 #include <vector>
 #include "vm_declarations.h"
@@ -16,7 +17,7 @@ public:
     void writeToAddress(VirtualAddress address, char value);
 	void markDirty(VirtualAddress address);
     char readFromAddress(VirtualAddress address);
-    void checkValue(VirtualAddress address, char value);
+    void checkValue(VirtualAddress address, char expectedValue, char value);
     bool isFinished() const;
     void run();
     ~ProcessTest();
@@ -32,7 +33,7 @@ private:
     std::vector<std::tuple<MemoryBackup, VirtualAddress, PageNum>> checkMemory;
     Process *process;
     SystemTest &systemTest;
-    bool finished;
+    std::atomic<bool> finished;
 };
 
 
@@ -0,0 +1,87 @@
+#include "Statistics.h"
+
+StatCounter::StatCounter() {
+	for (unsigned stripe = 0; stripe < STAT_STRIPES; stripe++) {
+		stripes[stripe].value = 0;
+	}
+}
+
+void StatCounter::add(unsigned long count) {
+	stripes[getStripe()].value.fetch_add(count, std::memory_order_relaxed);
+}
+
+unsigned long StatCounter::read() const {
+	unsigned long retVal = 0;
+	for (unsigned stripe = 0; stripe < STAT_STRIPES; stripe++) {
+		retVal += stripes[stripe].value.load(std::memory_order_relaxed);
+	}
+	return retVal;
+}
+
+unsigned StatCounter::getStripe() {
+	// threads are dealt stripes in turn the first time they count anything
+	static std::atomic<unsigned> nextStripe(0);
+	thread_local unsigned stripe = nextStripe++ % STAT_STRIPES;
+	return stripe;
+}
+
+void LatencyRecorder::record(std::chrono::steady_clock::duration latency) {
+	unsigned long microseconds = (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+	unsigned bucket = 0;
+	while ((bucket < LATENCY_BUCKETS - 1) && (microseconds >> bucket)) {
+		bucket++;
+	}
+	buckets[bucket].add();
+	totalMicroseconds.add(microseconds);
+}
+
+void LatencyRecorder::read(LatencyHistogram* histogram) const {
+	histogram->count = 0;
+	for (unsigned bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+		histogram->buckets[bucket] = buckets[bucket].read();
+		histogram->count += histogram->buckets[bucket];
+	}
+	histogram->totalMicroseconds = totalMicroseconds.read();
+}
+
+LatencyTimer::LatencyTimer(LatencyRecorder* recorder) {
+	this->recorder = recorder;
+	start = std::chrono::steady_clock::now();
+}
+
+LatencyTimer::~LatencyTimer() {
+	finish();
+}
+
+void LatencyTimer::finish() {
+	if (recorder) {
+		recorder->record(std::chrono::steady_clock::now() - start);
+		recorder = 0;
+	}
+}
+
+void ProcessCounters::read(ProcessStats* stats) const {
+	stats->hits = hits.read();
+	stats->minorFaults = minorFaults.read();
+	stats->majorFaults = majorFaults.read();
+	stats->cleanEvictions = cleanEvictions.read();
+	stats->dirtyEvictions = dirtyEvictions.read();
+	stats->prefetchedPages = prefetchedPages.read();
+	stats->prefetchHits = prefetchHits.read();
+	faultLatency.read(&stats->faultLatency);
+}
+
+void accumulateStats(ProcessStats* total, const ProcessStats& stats) {
+	total->hits += stats.hits;
+	total->minorFaults += stats.minorFaults;
+	total->majorFaults += stats.majorFaults;
+	total->cleanEvictions += stats.cleanEvictions;
+	total->dirtyEvictions += stats.dirtyEvictions;
+	total->prefetchedPages += stats.prefetchedPages;
+	total->prefetchHits += stats.prefetchHits;
+	total->faultLatency.count += stats.faultLatency.count;
+	total->faultLatency.totalMicroseconds += stats.faultLatency.totalMicroseconds;
+	for (unsigned bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+		total->faultLatency.buckets[bucket] += stats.faultLatency.buckets[bucket];
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include "vm_declarations.h"
+
+// A counter bumped from many threads at once. Each thread adds to a stripe of its own, on a cache line
+// of its own, so the fast path never contends; reading sums up the stripes without stopping anybody.
+class StatCounter {
+public:
+	StatCounter();
+	void add(unsigned long count = 1);
+	unsigned long read() const;
+private:
+	typedef struct alignas(64) Stripe {
+		std::atomic<unsigned long> value;
+	} Stripe;
+
+	Stripe stripes[STAT_STRIPES];
+
+	static unsigned getStripe();
+};
+
+class LatencyRecorder {
+public:
+	void record(std::chrono::steady_clock::duration latency);
+	void read(LatencyHistogram* histogram) const;
+private:
+	StatCounter totalMicroseconds;
+	StatCounter buckets[LATENCY_BUCKETS];
+};
+
+// Measures from construction until finish, or until it goes out of scope
+class LatencyTimer {
+public:
+	LatencyTimer(LatencyRecorder* recorder);
+	~LatencyTimer();
+	void finish();
+private:
+	LatencyRecorder* recorder;
+	std::chrono::steady_clock::time_point start;
+};
+
+// What stands behind ProcessStats, kept by every process
+typedef struct ProcessCounters {
+	StatCounter hits;
+	StatCounter minorFaults;
+	StatCounter majorFaults;
+	StatCounter cleanEvictions;
+	StatCounter dirtyEvictions;
+	StatCounter prefetchedPages;
+	StatCounter prefetchHits;
+	LatencyRecorder faultLatency;
+
+	void read(ProcessStats* stats) const;
+} ProcessCounters;
+
+// Adds the counts of one snapshot to another, for totals over several processes
+void accumulateStats(ProcessStats* total, const ProcessStats& stats);
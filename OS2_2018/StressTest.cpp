@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <thread>
+#include "StressTest.h"
+#include "TestUtils.h"
+#include "part.h"
+
+#define OVERCOMMIT_FACTOR (2)
+
+StressTest::StressTest(Partition &partition_, PageNum framesPerThread_)
+        : partition(partition_), framesPerThread(framesPerThread_), segmentSize(OVERCOMMIT_FACTOR * framesPerThread_),
+          errorCount(0) {
+}
+
+StressResult StressTest::run(unsigned threadCount, unsigned long accessesPerThread) {
+    PageNum processVMSpaceSize = threadCount * framesPerThread;
+    PageNum pmtSpaceSize = threadCount * SIZE_OF_PMT_IN_PAGES;
+    char *vmSpace = new char[(processVMSpaceSize + 2) * PAGE_SIZE];
+    char *pmtSpace = new char[(pmtSpaceSize + 2) * PAGE_SIZE];
+    StressResult result;
+    result.threadCount = threadCount;
+    result.accesses = threadCount * accessesPerThread;
+    {
+        System system(alignToPage(vmSpace), processVMSpaceSize, alignToPage(pmtSpace), pmtSpaceSize, &partition);
+        std::vector<Process *> processes;
+        for (unsigned i = 0; i < threadCount; i++) {
+            processes.push_back(system.createProcess());
+        }
+
+        std::atomic<bool> done(false);
+        std::thread ticker([&system, &done]() {
+            while (!done) {
+                std::this_thread::sleep_for(std::chrono::microseconds(system.periodicJob()));
+            }
+        });
+
+        // with many threads, starting them takes long enough for the first ones to get well ahead otherwise
+        std::atomic<bool> started(false);
+        std::vector<unsigned long> faultCounts(threadCount, 0);
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < threadCount; i++) {
+            threads.emplace_back(&StressTest::runProcess, this, std::ref(system), processes[i], i + 1, accessesPerThread,
+                                 std::cref(started), &faultCounts[i]);
+        }
+        auto start = std::chrono::steady_clock::now();
+        started = true;
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        done = true;
+        ticker.join();
+        for (auto process : processes) {
+            delete process;
+        }
+        result.faults = system.getReclaimStats().faults;
+        auto range = std::minmax_element(faultCounts.begin(), faultCounts.end());
+        result.minFaultRate = accessesPerThread ? (double) *range.first / accessesPerThread : 0;
+        result.maxFaultRate = accessesPerThread ? (double) *range.second / accessesPerThread : 0;
+    }
+    delete [] vmSpace;
+    delete [] pmtSpace;
+    return result;
+}
+
+unsigned long StressTest::getErrorCount() const {
+    return errorCount;
+}
+
+void StressTest::runProcess(System &system, Process *process, unsigned seed, unsigned long accessCount,
+                            const std::atomic<bool> &started, unsigned long *faultCount) {
+    const VirtualAddress base = PAGE_SIZE;
+    ProcessId pid = process->getProcessId();
+    if (OK != process->createSegment(base, segmentSize, READ_WRITE)) {
+        std::cout << "Cannot create data segment in process " << pid << std::endl;
+        errorCount++;
+        return;
+    }
+
+    // fresh pages read as zeros, so the shadow starts out zeroed as well
+    std::vector<uint32_t> shadow(segmentSize * PAGE_SIZE / sizeof(uint32_t), 0);
+    std::minstd_rand randomGenerator(seed);
+    while (!started) {
+        std::this_thread::yield();
+    }
+    for (unsigned long i = 0; i < accessCount; i++) {
+        size_t word = randomGenerator() % shadow.size();
+        VirtualAddress address = base + word * sizeof(uint32_t);
+        AccessType type = (randomGenerator() % 2) ? WRITE : READ;
+
+        unsigned slot = system.beginAccess(pid);
+        PhysicalAddress pa = 0;
+        Status status = system.access(pid, address, type, &pa);
+        while (status == PAGE_FAULT) {
+            system.endAccess(pid, slot);
+            (*faultCount)++;
+            if (OK != process->pageFault(address)) {
+                std::cout << "Page fault failed in process " << pid << " at " << address << std::endl;
+                errorCount++;
+                return;
+            }
+            slot = system.beginAccess(pid);
+            status = system.access(pid, address, type, &pa);
+        }
+        if (status != OK) {
+            system.endAccess(pid, slot);
+            std::cout << "Access trapped in process " << pid << " at " << address << std::endl;
+            errorCount++;
+            return;
+        }
+
+        if (type == WRITE) {
+            uint32_t value = (uint32_t)randomGenerator();
+            *(uint32_t *) pa = value;
+            shadow[word] = value;
+        } else if (*(uint32_t *) pa != shadow[word]) {
+            if (errorCount++ < 10) {
+                std::cout << "Process " << pid << " read " << *(uint32_t *) pa << " at " << address
+                          << " instead of " << shadow[word] << std::endl;
+            }
+        }
+        system.endAccess(pid, slot);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef VM_STRESSTEST_H
+#define VM_STRESSTEST_H
+
+
+#include <atomic>
+#include <vector>
+#include "vm_declarations.h"
+#include "Process.h"
+#include "System.h"
+
+class Partition;
+
+typedef struct StressResult {
+    unsigned threadCount;
+    double seconds;
+    unsigned long accesses;
+    unsigned long faults;
+    // the fewest and the most faults per access any one process took
+    double minFaultRate;
+    double maxFaultRate;
+} StressResult;
+
+// Every thread drives a process of its own over a data segment bigger than its share of memory,
+// so accesses keep faulting; whatever a thread writes is checked when it reads it back.
+// Every thread makes the same number of accesses whatever the thread count, and counts the faults of its
+// process, so a run shows how evenly memory was shared out next to how fast it went.
+// Nothing on the test side is shared between the threads, so they only ever wait for each other in the kernel.
+class StressTest {
+public:
+    StressTest(Partition &partition, PageNum framesPerThread);
+    // Runs the workload on a fresh system, timed from the moment all the threads are ready to go
+    StressResult run(unsigned threadCount, unsigned long accessesPerThread);
+    unsigned long getErrorCount() const;
+private:
+    void runProcess(System &system, Process *process, unsigned seed, unsigned long accessCount,
+                    const std::atomic<bool> &started, unsigned long *faultCount);
+
+    Partition &partition;
+    PageNum framesPerThread;
+    PageNum segmentSize;
+    std::atomic<unsigned long> errorCount;
+};
+
+
+#endif //VM_STRESSTEST_H
@@ -15,11 +15,96 @@ Process* System::createProcess() {
 	return pSystem->createProcess();
 }
 
+Process* System::cloneProcess(ProcessId pid) {
+	return pSystem->cloneProcess(pid);
+}
+
 Time System::periodicJob() {
 	return pSystem->periodicJob();
 }
 
+void System::setPeriodicJobConfig(PeriodicJobConfig config) {
+	pSystem->setPeriodicJobConfig(config);
+}
+
+PeriodicJobConfig System::getPeriodicJobConfig() {
+	return pSystem->getPeriodicJobConfig();
+}
+
+std::vector<Time> System::getTickHistory() {
+	return pSystem->getTickHistory();
+}
+
+void System::setReclaimWatermarks(PageNum lowWatermark, PageNum highWatermark) {
+	pSystem->setReclaimWatermarks(lowWatermark, highWatermark);
+}
+
+ReclaimStats System::getReclaimStats() {
+	return pSystem->getReclaimStats();
+}
+
+SystemStats System::getStats() {
+	return pSystem->getStats();
+}
+
+void System::printLockProfile() {
+	pSystem->printLockProfile();
+}
+
+void System::startTrace(unsigned long eventsPerThread) {
+	pSystem->startTrace(eventsPerThread);
+}
+
+void System::stopTrace() {
+	pSystem->stopTrace();
+}
+
+std::vector<TraceEvent> System::getTrace() {
+	return pSystem->getTrace();
+}
+
+Status System::writeTrace(const char* path) {
+	return pSystem->writeTrace(path);
+}
+
+Status System::setPinQuota(ProcessId pid, PageNum quota) {
+	return pSystem->setPinQuota(pid, quota);
+}
+
+Status System::suspendProcess(ProcessId pid) {
+	return pSystem->suspendProcess(pid);
+}
+
+Status System::resumeProcess(ProcessId pid) {
+	return pSystem->resumeProcess(pid);
+}
+
+Status System::addPhysicalMemory(PhysicalAddress startAddress, PageNum pageCount) {
+	return pSystem->addPhysicalMemory(startAddress, pageCount);
+}
+
+Status System::reclaimPhysicalMemory(PageNum pageCount, PhysicalAddress* startAddress) {
+	return pSystem->reclaimPhysicalMemory(pageCount, startAddress);
+}
+
 // Hardware job
 Status System::access(ProcessId pid, VirtualAddress address, AccessType type) {
-	return pSystem->access(pid, address, type);
+	return pSystem->access(pid, address, type, 0);
+}
+
+Status System::access(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress* physicalAddress) {
+	return pSystem->access(pid, address, type, physicalAddress);
+}
+
+Status System::accessBatch(ProcessId pid, const AccessRequest* requests, unsigned count,
+		AccessResult* results, std::vector<VirtualAddress>* faultingPages) {
+	return pSystem->accessBatch(pid, requests, count, results, faultingPages);
+}
+
+unsigned System::beginAccess(ProcessId pid) {
+	return pSystem->beginAccess(pid);
+}
+
+void System::endAccess(ProcessId pid, unsigned slot) {
+	pSystem->endAccess(pid, slot);
 }
@@ -14,9 +14,57 @@ public:
 		Partition* partition);
 	~System();
 	Process* createProcess();
+	// Creates a child sharing all of the process's memory copy-on-write, or returns 0 if there is no such process;
+	// a page is only copied once either side writes to it
+	Process* cloneProcess(ProcessId pid);
 	Time periodicJob();
+	void setPeriodicJobConfig(PeriodicJobConfig config);
+	PeriodicJobConfig getPeriodicJobConfig();
+	// Tick lengths returned by the most recent periodic jobs, oldest first
+	std::vector<Time> getTickHistory();
+	// The background reclaimer wakes up below lowWatermark free frames and evicts until there are highWatermark
+	void setReclaimWatermarks(PageNum lowWatermark, PageNum highWatermark);
+	ReclaimStats getReclaimStats();
+	// Counters of every process that ever ran, and of the partition, the allocator and the periodic job;
+	// taken while everything keeps running, so the numbers need not add up to the same instant
+	SystemStats getStats();
+	// Prints how often every lock was taken where, and how long it was waited for and held; only counts anything
+	// when built with LOCK_PROFILING set, and is printed once more when the system goes away
+	void printLockProfile();
+	// Starts recording accesses, faults, evictions, write-backs, segments and ticks, keeping the newest
+	// eventsPerThread events of every thread; a new trace drops the events of the one before
+	void startTrace(unsigned long eventsPerThread = TRACE_DEFAULT_CAPACITY);
+	void stopTrace();
+	// Events recorded so far, oldest first; can be taken while the trace is still running
+	std::vector<TraceEvent> getTrace();
+	// Writes the events as a TraceFileHeader followed by the TraceEvents, for TraceAnalyzer
+	Status writeTrace(const char* path);
+	// Number of pages the process may have pinned by lockSegment at a time
+	Status setPinQuota(ProcessId pid, PageNum quota);
+	// Swaps the whole process out at once, and brings back the pages it had resident at that point;
+	// the process is not expected to run in between, pages it touches anyway are faulted in as usual.
+	// Fails for a process with locked segments, they have to be unlocked first
+	Status suspendProcess(ProcessId pid);
+	Status resumeProcess(ProcessId pid);
+	// Hands the system another stretch of page-aligned memory to take frames from, which must not overlap what it has
+	Status addPhysicalMemory(PhysicalAddress startAddress, PageNum pageCount);
+	// Takes pages off the top of the stretch of memory added last, evicting whatever lives there while faults go on,
+	// and tells where the freed pages start. Fails if pinned pages are in the way, or the stretch is too small
+	Status reclaimPhysicalMemory(PageNum pageCount, PhysicalAddress* startAddress);
 	// Hardware job
 	Status access(ProcessId pid, VirtualAddress address, AccessType type);
+	// Hardware job: also hands back the translation it made, which getPhysicalAddress
+	// cannot be relied on for once another thread may be evicting the page
+	Status access(ProcessId pid, VirtualAddress address, AccessType type, PhysicalAddress* physicalAddress);
+	// Hardware job: translations obtained by access stay valid until the matching endAccess,
+	// evicting or cleaning a page of the process waits for them; never fault inside the bracket
+	unsigned beginAccess(ProcessId pid);
+	// Hardware job: translates all operands of an instruction at once, inside a single bracket.
+	// Returns TRAP if any operand traps, otherwise PAGE_FAULT if any needs its page brought in,
+	// in which case faultingPages gets every such page once, in the order they were first met
+	Status accessBatch(ProcessId pid, const AccessRequest* requests, unsigned count,
+		AccessResult* results, std::vector<VirtualAddress>* faultingPages);
+	void endAccess(ProcessId pid, unsigned slot);
 private:
 	KernelSystem *pSystem;
 	friend class Process;
@@ -6,65 +6,76 @@
 bool KernelSystem::firstEjectHappened;
 
 SystemTest::SystemTest(System &system_, void *processVMSpace, PageNum processVMSpaceSize)
-        : mutex(), system(system_), beginSpace(processVMSpace),
+        : hitCount(0), missCount(0), system(system_), beginSpace(processVMSpace),
           endSpace((void *) ((uint8_t *) beginSpace + PAGE_SIZE * processVMSpaceSize)) {
 }
 
 Status SystemTest::doInstruction(Process &process,
                                  const std::vector<std::tuple<VirtualAddress, AccessType, char>> addresses,
                                 ProcessTest &processTest) {
+    std::vector<AccessRequest> requests;
     for (auto iter = addresses.begin(); iter != addresses.end(); iter++) {
-        AccessType accessType = std::get<1>(*iter);
-        VirtualAddress address = std::get<0>(*iter);
-        char expectedValue = std::get<2>(*iter);
-        switch (accessType) {
-            case READ:
-            case EXECUTE: {
-                std::lock_guard<std::mutex> guard(mutex);
-
-                char value;
-                Status success = system.access(process.getProcessId(), address, accessType);
-                if (success != OK) {
-                    success = process.pageFault(address);
-                    if (success != OK) {
-                        return success;
-                    }
-                    success = system.access(process.getProcessId(), address, accessType);
-					if (KernelSystem::firstEjectHappened) missCount++;
-				} else {
-					if (KernelSystem::firstEjectHappened) hitCount++;
-				}
-                assert (success == OK);
+        AccessRequest request;
+        request.address = std::get<0>(*iter);
+        request.type = std::get<1>(*iter);
+        requests.push_back(request);
+    }
+    std::vector<AccessResult> results(requests.size());
+    std::vector<bool> missed(requests.size(), false);
 
-                PhysicalAddress pa = process.getPhysicalAddress(address);
-                checkAddress(pa);
-                value = *(char *) pa;
-                processTest.checkValue(address, expectedValue);
-                break;
+    // the whole instruction is translated in one go, when something faults the operands before it are done
+    // right away and all the missing pages are brought in together; since the background reclaimer may take
+    // pages away again meanwhile it can take a few rounds
+    ProcessId pid = process.getProcessId();
+    size_t done = 0;
+    while (done < requests.size()) {
+        std::vector<VirtualAddress> faultingPages;
+        unsigned slot = system.beginAccess(pid);
+        system.accessBatch(pid, &requests[done], requests.size() - done, &results[done], &faultingPages);
+        size_t ready = done;
+        for (; (ready < requests.size()) && (results[ready].status == OK); ready++) {
+            AccessType accessType = std::get<1>(addresses[ready]);
+            VirtualAddress address = std::get<0>(addresses[ready]);
+            char expectedValue = std::get<2>(addresses[ready]);
+            PhysicalAddress pa = results[ready].physicalAddress;
+            switch (accessType) {
+                case READ:
+                case EXECUTE: {
+                    char value;
+                    checkAddress(pa);
+                    value = *(char *) pa;
+                    processTest.checkValue(address, expectedValue, value);
+                    break;
+                }
+                case WRITE: {
+                    checkAddress(pa);
+                    *(char *) pa = expectedValue;
+                    processTest.markDirty(address);
+                    break;
+                }
+                default: break;
             }
-            case WRITE: {
-                std::lock_guard<std::mutex> guard(mutex);
-
-                Status success = system.access(process.getProcessId(), address, accessType);
-                if (success != OK) {
-                    success = process.pageFault(address);
-                    if (success != OK) {
-                        return success;
-                    }
-                    success = system.access(process.getProcessId(), address, accessType);
-					if (KernelSystem::firstEjectHappened) missCount++;
-				} else {
-					if (KernelSystem::firstEjectHappened) hitCount++;
-				}
-                assert (success == OK);
-
-                PhysicalAddress pa = process.getPhysicalAddress(address);
-                checkAddress(pa);
-                *(char *) pa = expectedValue;
-				processTest.markDirty(address);
-                break;
+            if (KernelSystem::firstEjectHappened) {
+                if (missed[ready]) missCount++;
+                else hitCount++;
             }
-            default: break;
+        }
+        system.endAccess(pid, slot);
+        done = ready;
+        if (done == requests.size()) {
+            break;
+        }
+        if (results[done].status == TRAP) {
+            return TRAP;
+        }
+        for (size_t i = done; i < requests.size(); i++) {
+            if (results[i].status == PAGE_FAULT) {
+                missed[i] = true;
+            }
+        }
+        Status success = process.pageFaultRange(faultingPages);
+        if (success != OK) {
+            return success;
         }
     }
     return OK;
@@ -75,7 +86,3 @@ void SystemTest::checkAddress(void *address) const {
     assert(address >= beginSpace);
     assert(address <= endSpace);
 }
-
-std::mutex &SystemTest::getGlobalMutex() {
-    return mutex;
-}
@@ -2,7 +2,7 @@
 #define VM_SYSTEMTEST_H
 
 
-#include <mutex>
+#include <atomic>
 #include <vector>
 #include "vm_declarations.h"
 #include "Process.h"
@@ -16,12 +16,11 @@ public:
     explicit SystemTest(System& system_, void *processVMSpace, PageNum processVMSpaceSize);
     Status doInstruction(Process &process, const std::vector<std::tuple<VirtualAddress, AccessType, char>> addresses,
                          ProcessTest &processTest);
-    std::mutex& getGlobalMutex();
-	unsigned long long hitCount = 0;
-	unsigned long long missCount = 0;
+    // bumped by all the process threads at once, instructions are not serialized
+	std::atomic<unsigned long long> hitCount;
+	std::atomic<unsigned long long> missCount;
 private:
     void checkAddress(void *address) const;
-    std::mutex mutex;
     System& system;
     void *beginSpace;
     void *endSpace;
@@ -0,0 +1,20 @@
+#ifndef VM_TESTUTILS_H
+#define VM_TESTUTILS_H
+
+
+#include <cstdint>
+#include "vm_declarations.h"
+
+// Memory handed to a System has to start on a page boundary, so the test drivers allocate a page
+// more than they need and start at the first boundary past the beginning
+inline PhysicalAddress alignToPage(PhysicalAddress address) {
+    uint64_t addr = reinterpret_cast<uint64_t> (address);
+
+    addr += PAGE_SIZE;
+    addr = addr / PAGE_SIZE * PAGE_SIZE;
+
+    return reinterpret_cast<PhysicalAddress> (addr);
+}
+
+
+#endif //VM_TESTUTILS_H
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include "TraceAnalyzer.h"
+
+#define REUSE_BUCKETS (32)
+
+static const char heatmapShades[] = " .:-=+*#%@";
+
+// an access that faults is retried once the page is in, only the one that goes through counts
+static bool isReference(const TraceEvent &event) {
+    return (event.type == TRACE_ACCESS) && (event.status == OK);
+}
+
+TraceAnalyzer::TraceAnalyzer(const std::vector<TraceEvent> &events_)
+        : events(events_), firstTimestamp(0), lastTimestamp(0) {
+    if (!events.empty()) {
+        firstTimestamp = events.front().timestamp;
+        lastTimestamp = events.back().timestamp;
+    }
+}
+
+bool TraceAnalyzer::load(const char *path, std::vector<TraceEvent> *events) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    TraceFileHeader header;
+    bool ok = (fread(&header, sizeof(header), 1, file) == 1)
+              && !memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))
+              && (header.version == TRACE_VERSION) && (header.eventSize == sizeof(TraceEvent));
+    if (ok) {
+        events->resize((size_t) header.eventCount);
+        ok = !header.eventCount || (fread(events->data(), sizeof(TraceEvent), events->size(), file) == events->size());
+    }
+    fclose(file);
+    return ok;
+}
+
+std::vector<unsigned> TraceAnalyzer::getProcesses() const {
+    std::vector<unsigned> pids;
+    for (auto &event : events) {
+        if ((event.type != TRACE_TICK) && (std::find(pids.begin(), pids.end(), event.pid) == pids.end())) {
+            pids.push_back(event.pid);
+        }
+    }
+    std::sort(pids.begin(), pids.end());
+    return pids;
+}
+
+unsigned TraceAnalyzer::getTimeBucket(const TraceEvent &event, unsigned timeBuckets) const {
+    uint64_t span = lastTimestamp - firstTimestamp + 1;
+    return (unsigned) ((event.timestamp - firstTimestamp) * timeBuckets / span);
+}
+
+void TraceAnalyzer::printFaultHeatmap(std::ostream &out, unsigned timeBuckets, unsigned pageBuckets) const {
+    out << "Fault heatmap, " << (lastTimestamp - firstTimestamp) / 1000 << "us left to right\n";
+    for (unsigned pid : getProcesses()) {
+        uint64_t lowPage = UINT64_MAX, highPage = 0;
+        for (auto &event : events) {
+            if ((event.pid == pid) && (event.type == TRACE_FAULT)) {
+                lowPage = std::min(lowPage, event.page);
+                highPage = std::max(highPage, event.page);
+            }
+        }
+        if (lowPage > highPage) {
+            continue;
+        }
+        uint64_t pageSpan = highPage - lowPage + 1;
+        unsigned rows = (unsigned) std::min((uint64_t) pageBuckets, pageSpan);
+        std::vector<unsigned long> cells(rows * timeBuckets, 0);
+        unsigned long hottest = 0;
+        for (auto &event : events) {
+            if ((event.pid != pid) || (event.type != TRACE_FAULT)) {
+                continue;
+            }
+            unsigned row = (unsigned) ((event.page - lowPage) * rows / pageSpan);
+            unsigned long &cell = cells[row * timeBuckets + getTimeBucket(event, timeBuckets)];
+            hottest = std::max(hottest, ++cell);
+        }
+        out << "Process " << pid << ", pages " << lowPage << " to " << highPage << " top to bottom, busiest cell "
+            << hottest << " faults\n";
+        for (unsigned row = 0; row < rows; row++) {
+            out << " |";
+            for (unsigned column = 0; column < timeBuckets; column++) {
+                unsigned long cell = cells[row * timeBuckets + column];
+                // anything at all shows, the busiest cell gets the darkest shade
+                size_t shade = cell ? 1 + (cell - 1) * (sizeof(heatmapShades) - 3) / std::max(hottest - 1, 1UL) : 0;
+                out << heatmapShades[shade];
+            }
+            out << "|\n";
+        }
+    }
+}
+
+void TraceAnalyzer::printReuseDistances(std::ostream &out) const {
+    // the stack distance of an access is the number of distinct pages touched since the last access to
+    // its page, which is the number of pages whose latest access lies in between; a Fenwick tree over
+    // the positions of the latest accesses counts them in logarithmic time
+    std::vector<long> tree(1, 0);
+    for (auto &event : events) {
+        if (isReference(event)) {
+            tree.push_back(0);
+        }
+    }
+    auto add = [&tree](size_t position, long delta) {
+        for (size_t i = position + 1; i < tree.size(); i += i & (~i + 1)) {
+            tree[i] += delta;
+        }
+    };
+    // latest accesses at positions up to and including the given one
+    auto sum = [&tree](size_t position) {
+        long retVal = 0;
+        for (size_t i = position + 1; i; i -= i & (~i + 1)) {
+            retVal += tree[i];
+        }
+        return retVal;
+    };
+
+    std::unordered_map<uint64_t, size_t> latest;
+    std::vector<unsigned long> buckets(REUSE_BUCKETS, 0);
+    unsigned long coldAccesses = 0, accesses = 0;
+    size_t position = 0;
+    for (auto &event : events) {
+        if (!isReference(event)) {
+            continue;
+        }
+        uint64_t key = ((uint64_t) event.pid << 48) | event.page;
+        auto previous = latest.find(key);
+        if (previous == latest.end()) {
+            coldAccesses++;
+        } else {
+            unsigned long distance = (unsigned long) (sum(position - 1) - sum(previous->second));
+            unsigned bucket = 0;
+            while ((bucket < REUSE_BUCKETS - 1) && (distance >> bucket)) {
+                bucket++;
+            }
+            buckets[bucket]++;
+            add(previous->second, -1);
+        }
+        add(position, 1);
+        latest[key] = position++;
+        accesses++;
+    }
+
+    out << "Reuse distances of " << accesses << " accesses to " << latest.size() << " pages, " << coldAccesses
+        << " first touches\n";
+    out << " distance below\taccesses\tLRU hit rate with that many frames\n";
+    unsigned long hits = 0;
+    for (unsigned bucket = 0; bucket < REUSE_BUCKETS; bucket++) {
+        hits += buckets[bucket];
+        if (buckets[bucket]) {
+            out << " " << (1UL << bucket) << "\t" << buckets[bucket] << "\t" << (accesses ? (double) hits / accesses : 0)
+                << "\n";
+        }
+    }
+}
+
+void TraceAnalyzer::printTimelines(std::ostream &out, unsigned timeBuckets) const {
+    uint64_t span = lastTimestamp - firstTimestamp + 1;
+    unsigned long ticks = 0;
+    for (auto &event : events) {
+        if (event.type == TRACE_TICK) {
+            ticks++;
+        }
+    }
+    out << "Timelines, " << span / timeBuckets / 1000 << "us per row, " << ticks << " ticks\n";
+    for (unsigned pid : getProcesses()) {
+        std::vector<unsigned long> counts(timeBuckets * (TRACE_TICK + 1), 0);
+        std::map<unsigned, std::vector<const TraceEvent *>> segmentChanges;
+        for (auto &event : events) {
+            if (event.pid != pid) {
+                continue;
+            }
+            unsigned bucket = getTimeBucket(event, timeBuckets);
+            counts[bucket * (TRACE_TICK + 1) + event.type]++;
+            if ((event.type == TRACE_SEGMENT_CREATE) || (event.type == TRACE_SEGMENT_DELETE)) {
+                segmentChanges[bucket].push_back(&event);
+            }
+        }
+        out << "Process " << pid << "\n";
+        out << " from us\taccesses\tfaults\tevictions\twrite-backs\tsegments\n";
+        for (unsigned bucket = 0; bucket < timeBuckets; bucket++) {
+            unsigned long *row = &counts[bucket * (TRACE_TICK + 1)];
+            if (!row[TRACE_ACCESS] && !row[TRACE_FAULT] && !row[TRACE_EVICTION] && !row[TRACE_WRITE_BACK]
+                && !segmentChanges.count(bucket)) {
+                continue;
+            }
+            out << " " << bucket * span / timeBuckets / 1000 << "\t" << row[TRACE_ACCESS] << "\t" << row[TRACE_FAULT] << "\t"
+                << row[TRACE_EVICTION] << "\t" << row[TRACE_WRITE_BACK] << "\t";
+            for (auto change : segmentChanges[bucket]) {
+                out << ((change->type == TRACE_SEGMENT_CREATE) ? "+" : "-") << change->page << ":" << change->count << " ";
+            }
+            out << "\n";
+        }
+    }
+}
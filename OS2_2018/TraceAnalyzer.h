@@ -0,0 +1,35 @@
+#ifndef VM_TRACEANALYZER_H
+#define VM_TRACEANALYZER_H
+
+
+#include <ostream>
+#include <vector>
+#include "vm_declarations.h"
+
+// Turns a trace written by System::writeTrace into reports for finding out why the system thrashes:
+// where in time and address space the faults happen, how far apart reuses of a page are compared to
+// the memory there is, and what every process was doing over time.
+class TraceAnalyzer {
+public:
+    explicit TraceAnalyzer(const std::vector<TraceEvent> &events);
+    // Reads a trace file, returns false if it cannot be read or is not a trace
+    static bool load(const char *path, std::vector<TraceEvent> *events);
+
+    // Faults of every process over time (columns) and its address space (rows)
+    void printFaultHeatmap(std::ostream &out, unsigned timeBuckets, unsigned pageBuckets) const;
+    // LRU stack distances between accesses to the same page of the same process, in pages; an LRU memory
+    // of N frames hits every access with a distance below N
+    void printReuseDistances(std::ostream &out) const;
+    // Accesses, faults, evictions and write-backs of every process over time, with its segment changes
+    void printTimelines(std::ostream &out, unsigned timeBuckets) const;
+private:
+    std::vector<unsigned> getProcesses() const;
+    unsigned getTimeBucket(const TraceEvent &event, unsigned timeBuckets) const;
+
+    const std::vector<TraceEvent> &events;
+    uint64_t firstTimestamp;
+    uint64_t lastTimestamp;
+};
+
+
+#endif //VM_TRACEANALYZER_H
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include "TraceReplay.h"
+#include "TestUtils.h"
+#include "TraceAnalyzer.h"
+#include "Process.h"
+#include "System.h"
+#include "part.h"
+
+// pages of different processes are different pages
+static uint64_t getPageKey(const ReplayAccess &access) {
+    return ((uint64_t) access.pid << 48) | (access.address / PAGE_SIZE);
+}
+
+static ReplayResult makeResult(const char *policy, PageNum frames) {
+    ReplayResult result;
+    result.policy = policy;
+    result.frames = frames;
+    result.accesses = result.hits = result.faults = result.reads = result.writes = 0;
+    result.clusterReads = result.clusterWrites = 0;
+    result.seconds = 0;
+    return result;
+}
+
+TraceReplay::TraceReplay(Partition &partition_, PageNum frames_, unsigned long accessesPerTick_)
+        : partition(partition_), frames(frames_), accessesPerTick(accessesPerTick_) {
+    // the same watermarks the system starts with
+    PageNum lowWatermark = std::max(frames / DEFAULT_LOW_WATERMARK_DIVISOR, (PageNum) 1);
+    PageNum highWatermark = std::max(frames / DEFAULT_HIGH_WATERMARK_DIVISOR, lowWatermark + 1);
+    simulatedFrames = (frames > highWatermark) ? frames - highWatermark : 1;
+}
+
+bool TraceReplay::load(const char *path, std::vector<ReplayAccess> *accesses) {
+    std::vector<TraceEvent> events;
+    if (TraceAnalyzer::load(path, &events)) {
+        for (auto &event : events) {
+            // an access that faulted shows up again once its page was brought in
+            if ((event.type == TRACE_ACCESS) && (event.status == OK)) {
+                accesses->push_back({event.pid, (VirtualAddress) (event.page * PAGE_SIZE), (AccessType) event.accessType});
+            }
+        }
+        return true;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        if ((line[0] == '#') || (line[0] == '\n')) {
+            continue;
+        }
+        char *next;
+        ReplayAccess access;
+        access.pid = (ProcessId) strtoul(line, &next, 0);
+        access.address = strtoul(next, &next, 0);
+        while (*next == ' ' || *next == '\t' || *next == ',') {
+            next++;
+        }
+        switch (*next) {
+            case 'R': case 'r': access.type = READ; break;
+            case 'W': case 'w': access.type = WRITE; break;
+            case 'X': case 'x': access.type = EXECUTE; break;
+            default: ok = false;
+        }
+        if (!access.address) {
+            ok = false;
+        } else {
+            accesses->push_back(access);
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+ReplayResult TraceReplay::runSystem(const std::vector<ReplayAccess> &accesses) {
+    // every run of pages a process touches becomes a segment allowing whatever was done to them
+    std::map<ProcessId, std::map<PageNum, int>> pages;
+    for (auto &access : accesses) {
+        pages[access.pid][access.address / PAGE_SIZE] |= access.type;
+    }
+
+    PageNum pmtSpaceSize = pages.size() * SIZE_OF_PMT_IN_PAGES;
+    char *vmSpace = new char[(frames + 2) * PAGE_SIZE];
+    char *pmtSpace = new char[(pmtSpaceSize + 2) * PAGE_SIZE];
+    ReplayResult result = makeResult("system", frames);
+    {
+        System system(alignToPage(vmSpace), frames, alignToPage(pmtSpace), pmtSpaceSize, &partition);
+        std::map<ProcessId, Process *> processes;
+        for (auto &process : pages) {
+            Process *p = system.createProcess();
+            processes[process.first] = p;
+            for (auto page = process.second.begin(); page != process.second.end();) {
+                PageNum first = page->first, count = 0;
+                int flags = 0;
+                for (; (page != process.second.end()) && (page->first == first + count); page++, count++) {
+                    flags |= page->second;
+                }
+                p->createSegment(first * PAGE_SIZE, count, (AccessType) flags);
+            }
+        }
+
+        SystemStats before = system.getStats();
+        auto start = std::chrono::steady_clock::now();
+        unsigned long replayed = 0;
+        for (auto &access : accesses) {
+            Process *p = processes[access.pid];
+            ProcessId pid = p->getProcessId();
+            Status status = system.access(pid, access.address, access.type);
+            if (status == OK) {
+                result.hits++;
+            } else if (status == PAGE_FAULT) {
+                result.faults++;
+                while ((status == PAGE_FAULT) && (p->pageFault(access.address) == OK)) {
+                    status = system.access(pid, access.address, access.type);
+                }
+            }
+            if (accessesPerTick && !(++replayed % accessesPerTick)) {
+                system.periodicJob();
+            }
+        }
+        result.accesses = accesses.size();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        SystemStats after = system.getStats();
+        result.reads = after.processes.majorFaults - before.processes.majorFaults;
+        result.writes = after.processes.dirtyEvictions - before.processes.dirtyEvictions;
+        result.clusterReads = after.clusterReads - before.clusterReads;
+        result.clusterWrites = after.clusterWrites - before.clusterWrites;
+
+        for (auto &process : processes) {
+            delete process.second;
+        }
+    }
+    delete[] vmSpace;
+    delete[] pmtSpace;
+    return result;
+}
+
+ReplayResult TraceReplay::simulateLRU(const std::vector<ReplayAccess> &accesses) const {
+    // writes are evictions of pages written since they were brought in, and reads are misses on pages
+    // that were written out before; like in the system, any other page starts out zeroed
+    ReplayResult result = makeResult("LRU", simulatedFrames);
+    std::list<uint64_t> recency;
+    std::unordered_map<uint64_t, std::pair<std::list<uint64_t>::iterator, bool>> resident;
+    std::set<uint64_t> swapped;
+    for (auto &access : accesses) {
+        uint64_t key = getPageKey(access);
+        bool write = (access.type & WRITE) != 0;
+        auto page = resident.find(key);
+        if (page != resident.end()) {
+            result.hits++;
+            recency.splice(recency.begin(), recency, page->second.first);
+            page->second.second = page->second.second || write;
+        } else {
+            result.faults++;
+            if (swapped.count(key)) {
+                result.reads++;
+            }
+            if (resident.size() == simulatedFrames) {
+                auto victim = resident.find(recency.back());
+                if (victim->second.second) {
+                    result.writes++;
+                    swapped.insert(victim->first);
+                }
+                resident.erase(victim);
+                recency.pop_back();
+            }
+            recency.push_front(key);
+            resident[key] = std::make_pair(recency.begin(), write);
+        }
+        result.accesses++;
+    }
+    return result;
+}
+
+ReplayResult TraceReplay::simulateOptimal(const std::vector<ReplayAccess> &accesses) const {
+    // Belady: when a page has to go, it is the one whose next use lies furthest ahead
+    ReplayResult result = makeResult("OPT", simulatedFrames);
+    std::vector<size_t> nextUse(accesses.size());
+    std::unordered_map<uint64_t, size_t> upcoming;
+    for (size_t i = accesses.size(); i--;) {
+        uint64_t key = getPageKey(accesses[i]);
+        auto next = upcoming.find(key);
+        nextUse[i] = (next != upcoming.end()) ? next->second : accesses.size() + i;
+        upcoming[key] = i;
+    }
+
+    // resident pages ordered by their next use, the last one goes first
+    std::set<std::pair<size_t, uint64_t>> byNextUse;
+    std::unordered_map<uint64_t, std::pair<size_t, bool>> resident;
+    std::set<uint64_t> swapped;
+    for (size_t i = 0; i < accesses.size(); i++) {
+        uint64_t key = getPageKey(accesses[i]);
+        bool write = (accesses[i].type & WRITE) != 0;
+        auto page = resident.find(key);
+        if (page != resident.end()) {
+            result.hits++;
+            byNextUse.erase(std::make_pair(page->second.first, key));
+            page->second.first = nextUse[i];
+            page->second.second = page->second.second || write;
+        } else {
+            result.faults++;
+            if (swapped.count(key)) {
+                result.reads++;
+            }
+            if (resident.size() == simulatedFrames) {
+                auto victim = std::prev(byNextUse.end());
+                if (resident[victim->second].second) {
+                    result.writes++;
+                    swapped.insert(victim->second);
+                }
+                resident.erase(victim->second);
+                byNextUse.erase(victim);
+            }
+            resident[key] = std::make_pair(nextUse[i], write);
+        }
+        byNextUse.insert(std::make_pair(nextUse[i], key));
+        result.accesses++;
+    }
+    return result;
+}
+
+void TraceReplay::printResults(std::ostream &out, const std::vector<ReplayResult> &results) {
+    out << "policy\tframes\taccesses\thit rate\tfaults\tfaults/s\treads\twrites\tcluster reads\tcluster writes\n";
+    for (auto &result : results) {
+        out << result.policy << "\t" << result.frames << "\t" << result.accesses << "\t"
+            << (result.accesses ? (double) result.hits / result.accesses : 0) << "\t" << result.faults << "\t";
+        if (result.seconds > 0) {
+            out << (unsigned long) (result.faults / result.seconds);
+        } else {
+            out << "-";
+        }
+        out << "\t" << result.reads << "\t" << result.writes << "\t";
+        if (result.seconds > 0) {
+            out << result.clusterReads << "\t" << result.clusterWrites << "\n";
+        } else {
+            out << "-\t-\n";
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef VM_TRACEREPLAY_H
+#define VM_TRACEREPLAY_H
+
+
+#include <ostream>
+#include <vector>
+#include "vm_declarations.h"
+
+class Partition;
+
+typedef struct ReplayAccess {
+    ProcessId pid;
+    VirtualAddress address;
+    AccessType type;
+} ReplayAccess;
+
+typedef struct ReplayResult {
+    const char *policy;
+    // frames the policy kept pages in
+    PageNum frames;
+    unsigned long accesses;
+    unsigned long hits;
+    unsigned long faults;
+    // pages read back from the partition, and dirty pages evicted, which are what the policies decide
+    unsigned long reads;
+    unsigned long writes;
+    // everything the partition did, including the cluster chains; zero for the policies that are only simulated
+    unsigned long clusterReads;
+    unsigned long clusterWrites;
+    double seconds;
+} ReplayResult;
+
+// Replays a recorded reference string against a fresh system as fast as it goes, and against offline
+// simulations of LRU and of Belady's optimal policy, which no policy can beat. The system's reclaimer keeps
+// up to its high watermark of frames free, so the simulations get only the frames the system can keep in use.
+// Every process gets segments covering the pages it touches; accesses are replayed in trace order from a
+// single thread, so runs are repeatable, with a periodic job every so many accesses.
+class TraceReplay {
+public:
+    TraceReplay(Partition &partition, PageNum frames, unsigned long accessesPerTick);
+    // Reads a trace written by System::writeTrace, taking the accesses that went through, or a text file
+    // with a "pid address type" line per access, the type being R, W or X; returns false if it cannot
+    static bool load(const char *path, std::vector<ReplayAccess> *accesses);
+
+    ReplayResult runSystem(const std::vector<ReplayAccess> &accesses);
+    ReplayResult simulateLRU(const std::vector<ReplayAccess> &accesses) const;
+    ReplayResult simulateOptimal(const std::vector<ReplayAccess> &accesses) const;
+    static void printResults(std::ostream &out, const std::vector<ReplayResult> &results);
+private:
+    Partition &partition;
+    PageNum frames;
+    PageNum simulatedFrames;
+    unsigned long accessesPerTick;
+};
+
+
+#endif //VM_TRACEREPLAY_H
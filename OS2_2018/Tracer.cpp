@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "Tracer.h"
+
+// a thread tracing into this many systems at once keeps a buffer in each, beyond that it starts new ones
+#define CACHED_BUFFERS 4
+
+static std::atomic<uint64_t> nextGeneration(1);
+
+// the buffers the thread recorded into last, the most recent first, each good for the trace of its generation
+typedef struct CachedBuffer {
+	uint64_t generation;
+	void* buffer;
+} CachedBuffer;
+
+static thread_local CachedBuffer cachedBuffers[CACHED_BUFFERS];
+
+Tracer::Tracer() {
+	enabled = false;
+	generation = 0;
+}
+
+Tracer::~Tracer() {
+	for (auto buffer : buffers) {
+		delete[] buffer->events;
+		delete buffer;
+	}
+	for (auto buffer : retiredBuffers) {
+		delete[] buffer->events;
+		delete buffer;
+	}
+}
+
+void Tracer::start(unsigned long eventsPerThread) {
+	if (!eventsPerThread) {
+		throw std::exception();
+	}
+	std::unique_lock<std::mutex> lock(_mutex);
+	enabled = false;
+	retiredBuffers.insert(retiredBuffers.end(), buffers.begin(), buffers.end());
+	buffers.clear();
+	capacity = eventsPerThread;
+	startTime = std::chrono::steady_clock::now();
+	generation = nextGeneration++;
+	enabled = true;
+}
+
+void Tracer::stop() {
+	enabled = false;
+}
+
+void Tracer::append(TraceEventType type, ProcessId pid, VirtualAddress address, PhysicalAddress frame,
+		unsigned long count, AccessType accessType, Status status) {
+	ThreadBuffer* buffer = getBuffer();
+	uint64_t head = buffer->head.load(std::memory_order_relaxed);
+	TraceEvent* event = &buffer->events[head % buffer->capacity];
+	event->timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+	event->page = address / PAGE_SIZE;
+	event->frame = (uint64_t)frame / PAGE_SIZE;
+	event->pid = pid;
+	event->count = (uint32_t)count;
+	event->type = (uint8_t)type;
+	event->accessType = (uint8_t)accessType;
+	event->status = (uint8_t)status;
+	memset(event->reserved, 0, sizeof(event->reserved));
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+Tracer::ThreadBuffer* Tracer::getBuffer() {
+	uint64_t currentGeneration = generation.load(std::memory_order_acquire);
+	unsigned found = 0;
+	while ((found < CACHED_BUFFERS - 1) && (cachedBuffers[found].generation != currentGeneration)) {
+		found++;
+	}
+	if (cachedBuffers[found].generation != currentGeneration) {
+		// first event of the thread in this trace, the least recently used entry makes room for it
+		std::unique_lock<std::mutex> lock(_mutex);
+		ThreadBuffer* buffer = new ThreadBuffer();
+		buffer->capacity = capacity;
+		buffer->events = new TraceEvent[capacity];
+		buffer->head = 0;
+		buffers.push_back(buffer);
+		cachedBuffers[found].generation = currentGeneration;
+		cachedBuffers[found].buffer = buffer;
+	}
+	// keep the one in use at the front, where the next lookup finds it first
+	CachedBuffer cached = cachedBuffers[found];
+	for (; found; found--) {
+		cachedBuffers[found] = cachedBuffers[found - 1];
+	}
+	cachedBuffers[0] = cached;
+	return (ThreadBuffer*)cached.buffer;
+}
+
+std::vector<TraceEvent> Tracer::collect() {
+	std::vector<TraceEvent> retVal;
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (auto buffer : buffers) {
+		uint64_t head = buffer->head.load(std::memory_order_acquire);
+		uint64_t first = (head > buffer->capacity) ? head - buffer->capacity : 0;
+		size_t copied = retVal.size();
+		for (uint64_t i = first; i < head; i++) {
+			retVal.push_back(buffer->events[i % buffer->capacity]);
+		}
+		// the thread may have lapped us while we copied, an event it is writing right now takes the slot of head - capacity
+		uint64_t newHead = buffer->head.load(std::memory_order_acquire);
+		uint64_t valid = (newHead + 1 > buffer->capacity) ? newHead + 1 - buffer->capacity : 0;
+		if (valid > first) {
+			retVal.erase(retVal.begin() + copied, retVal.begin() + copied + (size_t)std::min(valid - first, head - first));
+		}
+	}
+	lock.unlock();
+	std::stable_sort(retVal.begin(), retVal.end(), [](const TraceEvent& a, const TraceEvent& b) {
+		return a.timestamp < b.timestamp;
+	});
+	return retVal;
+}
+
+Status Tracer::write(const char* path) {
+	std::vector<TraceEvent> events = collect();
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		printf("Cannot open trace file %s\n", path);
+		return TRAP;
+	}
+	TraceFileHeader header;
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.eventSize = sizeof(TraceEvent);
+	header.eventCount = events.size();
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (written && !events.empty()) {
+		written = fwrite(events.data(), sizeof(TraceEvent), events.size(), file) == events.size();
+	}
+	written = !fclose(file) && written;
+	return written ? OK : TRAP;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include "vm_declarations.h"
+
+// Records kernel events into a ring buffer per thread. Each thread only ever writes its own buffer, so recording
+// takes no lock, and costs a single relaxed load while tracing is off. Buffers keep the newest events, older ones
+// are overwritten; collecting them does not stop the threads, events overwritten meanwhile are left out.
+class Tracer {
+public:
+	Tracer();
+	~Tracer();
+	// starts a new trace, the events of the previous one are dropped
+	void start(unsigned long eventsPerThread);
+	void stop();
+	// events of all threads, oldest first
+	std::vector<TraceEvent> collect();
+	Status write(const char* path);
+
+	bool isEnabled() const {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void record(TraceEventType type, ProcessId pid, VirtualAddress address, PhysicalAddress frame,
+			unsigned long count = 0, AccessType accessType = (AccessType)0, Status status = OK) {
+		if (isEnabled()) {
+			append(type, pid, address, frame, count, accessType, status);
+		}
+	}
+private:
+	typedef struct ThreadBuffer {
+		TraceEvent* events;
+		unsigned long capacity;
+		// events ever written, the newest is at (head - 1) % capacity
+		std::atomic<uint64_t> head;
+	} ThreadBuffer;
+
+	std::atomic<bool> enabled;
+	// tells this trace's buffers apart from those threads still have cached from an earlier one, or from other tracers
+	std::atomic<uint64_t> generation;
+	unsigned long capacity = TRACE_DEFAULT_CAPACITY;
+	std::chrono::steady_clock::time_point startTime;
+	// guards the list of buffers, taken by a thread only when it records its first event in a trace
+	std::mutex _mutex;
+	std::vector<ThreadBuffer*> buffers;
+	// buffers of earlier traces, a thread may still be finishing an event in one; they go with the tracer
+	std::vector<ThreadBuffer*> retiredBuffers;
+
+	void append(TraceEventType type, ProcessId pid, VirtualAddress address, PhysicalAddress frame,
+		unsigned long count, AccessType accessType, Status status);
+	ThreadBuffer* getBuffer();
+};
@@ -0,0 +1,130 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned workerCount) {
+	if (!workerCount) {
+		workerCount = 1;
+	}
+	queueCount = workerCount;
+	queues = new WorkerQueue[queueCount];
+	nextQueue = 0;
+	queuedTasks = 0;
+	for (unsigned i = 0; i < workerCount; i++) {
+		workers.emplace_back(&WorkerPool::workerLoop, this, i);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (auto& w : workers) {
+		w.join();
+	}
+	delete[] queues;
+}
+
+void WorkerPool::run(std::vector<Task>& tasks) {
+	if (tasks.empty()) {
+		return;
+	}
+	// the workers may still come across their share of the batch after we have returned, it must outlive us
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+	batch->tasks = tasks;
+	batch->next = 0;
+	batch->remaining = tasks.size();
+	for (size_t i = 0; i < tasks.size(); i++) {
+		push([batch]() { runNext(batch.get()); });
+	}
+
+	// rather than just sleep, the caller works through the batch; it leaves other tasks, like prefetches,
+	// to the workers, so it never gets held up by anything it did not ask for
+	while (runNext(batch.get())) {
+	}
+
+	std::unique_lock<std::mutex> lock(batch->_mutex);
+	batch->done.wait(lock, [&batch]() { return !batch->remaining; });
+	if (batch->error) {
+		std::rethrow_exception(batch->error);
+	}
+}
+
+bool WorkerPool::runNext(Batch* batch) {
+	size_t i = batch->next++;
+	if (i >= batch->tasks.size()) {
+		return false;
+	}
+	std::exception_ptr error;
+	try {
+		batch->tasks[i]();
+	} catch (...) {
+		error = std::current_exception();
+	}
+	std::unique_lock<std::mutex> lock(batch->_mutex);
+	if (error && !batch->error) {
+		batch->error = error;
+	}
+	if (!--batch->remaining) {
+		batch->done.notify_all();
+	}
+	return true;
+}
+
+void WorkerPool::submit(Task task) {
+	push(task);
+}
+
+unsigned WorkerPool::getWorkerCount() const {
+	return workers.size();
+}
+
+void WorkerPool::push(Task task) {
+	WorkerQueue* queue = &(queues[nextQueue++ % queueCount]);
+	{
+		std::unique_lock<std::mutex> lock(queue->_mutex);
+		queue->tasks.push_back(task);
+	}
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		queuedTasks++;
+	}
+	workAvailable.notify_one();
+}
+
+bool WorkerPool::pop(unsigned queue, Task* task) {
+	for (unsigned i = 0; i < queueCount; i++) {
+		WorkerQueue* theQueue = &(queues[(queue + i) % queueCount]);
+		std::unique_lock<std::mutex> lock(theQueue->_mutex);
+		if (theQueue->tasks.empty()) {
+			continue;
+		}
+		if (!i) {
+			// our own queue, take the oldest task
+			*task = theQueue->tasks.front();
+			theQueue->tasks.pop_front();
+		} else {
+			// somebody else's queue, steal from the other end
+			*task = theQueue->tasks.back();
+			theQueue->tasks.pop_back();
+		}
+		queuedTasks--;
+		return true;
+	}
+	return false;
+}
+
+void WorkerPool::workerLoop(unsigned queue) {
+	while (true) {
+		Task task;
+		if (pop(queue, &task)) {
+			task();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(_mutex);
+		workAvailable.wait(lock, [this]() { return stopping || queuedTasks; });
+		if (stopping && !queuedTasks) {
+			return;
+		}
+	}
+}
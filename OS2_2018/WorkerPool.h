@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void()> Task;
+
+// Fixed set of worker threads, each with its own task deque. A worker takes tasks from the
+// front of its own deque and, when that runs dry, steals from the back of the others.
+class WorkerPool {
+public:
+	WorkerPool(unsigned workerCount);
+	~WorkerPool();
+	// Runs all the tasks and returns once every one of them has finished, the caller helps out meanwhile
+	// with these tasks only; if any of them throws, the first exception is rethrown at the end
+	void run(std::vector<Task>& tasks);
+	// Queues a single task and returns immediately
+	void submit(Task task);
+	unsigned getWorkerCount() const;
+private:
+	typedef struct WorkerQueue {
+		std::mutex _mutex;
+		std::deque<Task> tasks;
+	} WorkerQueue;
+
+	// the tasks of one run, whoever gets to the batch first runs the next task nobody has taken yet
+	typedef struct Batch {
+		std::vector<Task> tasks;
+		std::atomic<size_t> next;
+		std::mutex _mutex;
+		std::condition_variable done;
+		size_t remaining;
+		std::exception_ptr error;
+	} Batch;
+
+	std::vector<std::thread> workers;
+	WorkerQueue* queues;
+	unsigned queueCount;
+	std::atomic<unsigned> nextQueue;
+	std::atomic<unsigned> queuedTasks;
+
+	std::mutex _mutex;
+	std::condition_variable workAvailable;
+	bool stopping = false;
+
+	void push(Task task);
+	bool pop(unsigned queue, Task* task);
+	static bool runNext(Batch* batch);
+	void workerLoop(unsigned queue);
+};
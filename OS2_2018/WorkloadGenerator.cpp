@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cmath>
+#include "WorkloadGenerator.h"
+
+ZipfianGenerator::ZipfianGenerator(double theta_) : theta(theta_) {
+}
+
+const char *ZipfianGenerator::getName() const {
+    return "zipfian";
+}
+
+WorkloadGenerator *ZipfianGenerator::create(PageNum segmentSize, PageNum /*memoryShare*/, unsigned seed) const {
+    ZipfianGenerator *generator = new ZipfianGenerator(theta);
+    generator->random.seed(seed);
+    double total = 0;
+    for (PageNum rank = 1; rank <= segmentSize; rank++) {
+        total += 1.0 / std::pow((double) rank, theta);
+        generator->cumulative.push_back(total);
+        generator->pageOfRank.push_back(rank - 1);
+    }
+    for (auto &weight : generator->cumulative) {
+        weight /= total;
+    }
+    std::shuffle(generator->pageOfRank.begin(), generator->pageOfRank.end(), generator->random);
+    return generator;
+}
+
+PageNum ZipfianGenerator::nextPage() {
+    double point = std::uniform_real_distribution<double>(0, 1)(random);
+    size_t rank = std::lower_bound(cumulative.begin(), cumulative.end(), point) - cumulative.begin();
+    return pageOfRank[std::min(rank, pageOfRank.size() - 1)];
+}
+
+const char *SequentialGenerator::getName() const {
+    return "sequential";
+}
+
+WorkloadGenerator *SequentialGenerator::create(PageNum segmentSize, PageNum /*memoryShare*/, unsigned /*seed*/) const {
+    SequentialGenerator *generator = new SequentialGenerator();
+    generator->segmentSize = segmentSize;
+    return generator;
+}
+
+PageNum SequentialGenerator::nextPage() {
+    PageNum retVal = next;
+    next = (next + 1) % segmentSize;
+    return retVal;
+}
+
+LoopGenerator::LoopGenerator(double oversize_) : oversize(oversize_) {
+}
+
+const char *LoopGenerator::getName() const {
+    return "loop";
+}
+
+WorkloadGenerator *LoopGenerator::create(PageNum segmentSize, PageNum memoryShare, unsigned /*seed*/) const {
+    LoopGenerator *generator = new LoopGenerator(oversize);
+    generator->loopSize = std::min(std::max((PageNum) (memoryShare * oversize), (PageNum) 1), segmentSize);
+    return generator;
+}
+
+PageNum LoopGenerator::nextPage() {
+    PageNum retVal = next;
+    next = (next + 1) % loopSize;
+    return retVal;
+}
+
+PhaseGenerator::PhaseGenerator(double hotFraction_, unsigned long phaseLength_)
+        : hotFraction(hotFraction_), phaseLength(phaseLength_) {
+}
+
+const char *PhaseGenerator::getName() const {
+    return "phases";
+}
+
+WorkloadGenerator *PhaseGenerator::create(PageNum segmentSize, PageNum memoryShare, unsigned seed) const {
+    PhaseGenerator *generator = new PhaseGenerator(hotFraction, phaseLength);
+    generator->random.seed(seed);
+    generator->segmentSize = segmentSize;
+    generator->hotSize = std::min(std::max((PageNum) (memoryShare * hotFraction), (PageNum) 1), segmentSize);
+    return generator;
+}
+
+PageNum PhaseGenerator::nextPage() {
+    if (phaseLength && !(accesses++ % phaseLength)) {
+        hotStart = random() % (segmentSize - hotSize + 1);
+    }
+    return hotStart + random() % hotSize;
+}
+
+MixedGenerator::MixedGenerator(double theta_, double scanFraction_) : theta(theta_), scanFraction(scanFraction_) {
+}
+
+MixedGenerator::~MixedGenerator() {
+    delete oltp;
+    delete scan;
+}
+
+const char *MixedGenerator::getName() const {
+    return "mixed";
+}
+
+WorkloadGenerator *MixedGenerator::create(PageNum segmentSize, PageNum memoryShare, unsigned seed) const {
+    MixedGenerator *generator = new MixedGenerator(theta, scanFraction);
+    generator->random.seed(seed);
+    generator->oltp = ZipfianGenerator(theta).create(segmentSize, memoryShare, seed);
+    generator->scan = SequentialGenerator().create(segmentSize, memoryShare, seed);
+    return generator;
+}
+
+PageNum MixedGenerator::nextPage() {
+    bool scanning = std::uniform_real_distribution<double>(0, 1)(random) < scanFraction;
+    return (scanning ? scan : oltp)->nextPage();
+}
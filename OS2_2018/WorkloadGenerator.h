@@ -0,0 +1,95 @@
+#ifndef VM_WORKLOADGENERATOR_H
+#define VM_WORKLOADGENERATOR_H
+
+
+#include <random>
+#include <vector>
+#include "vm_declarations.h"
+
+// Produces the pages one process touches, in order. A generator describes a kind of workload; create
+// makes the one a particular process runs, sized to its segment and to its share of memory, so new
+// workloads plug into Benchmark by deriving from this.
+class WorkloadGenerator {
+public:
+    virtual ~WorkloadGenerator() {}
+    virtual const char *getName() const = 0;
+    virtual WorkloadGenerator *create(PageNum segmentSize, PageNum memoryShare, unsigned seed) const = 0;
+    // page of the segment to access next, counted from its start
+    virtual PageNum nextPage() = 0;
+};
+
+// A hot set: page popularity falls off as a power of its rank, with the popular pages spread over the segment
+class ZipfianGenerator : public WorkloadGenerator {
+public:
+    explicit ZipfianGenerator(double theta);
+    const char *getName() const override;
+    WorkloadGenerator *create(PageNum segmentSize, PageNum memoryShare, unsigned seed) const override;
+    PageNum nextPage() override;
+private:
+    double theta;
+    std::minstd_rand random;
+    std::vector<double> cumulative;
+    std::vector<PageNum> pageOfRank;
+};
+
+// Reads the whole segment front to back, over and over
+class SequentialGenerator : public WorkloadGenerator {
+public:
+    const char *getName() const override;
+    WorkloadGenerator *create(PageNum segmentSize, PageNum memoryShare, unsigned seed) const override;
+    PageNum nextPage() override;
+private:
+    PageNum segmentSize = 1;
+    PageNum next = 0;
+};
+
+// Cycles through a working set that is a bit larger than the process's share of memory,
+// which is the worst case for LRU-like policies
+class LoopGenerator : public WorkloadGenerator {
+public:
+    explicit LoopGenerator(double oversize);
+    const char *getName() const override;
+    WorkloadGenerator *create(PageNum segmentSize, PageNum memoryShare, unsigned seed) const override;
+    PageNum nextPage() override;
+private:
+    double oversize;
+    PageNum loopSize = 1;
+    PageNum next = 0;
+};
+
+// Uniform accesses over a hot set that fits in memory, which moves elsewhere in the segment every so often
+class PhaseGenerator : public WorkloadGenerator {
+public:
+    PhaseGenerator(double hotFraction, unsigned long phaseLength);
+    const char *getName() const override;
+    WorkloadGenerator *create(PageNum segmentSize, PageNum memoryShare, unsigned seed) const override;
+    PageNum nextPage() override;
+private:
+    double hotFraction;
+    unsigned long phaseLength;
+    std::minstd_rand random;
+    PageNum segmentSize = 1;
+    PageNum hotSize = 1;
+    PageNum hotStart = 0;
+    unsigned long accesses = 0;
+};
+
+// Transactions hitting a Zipfian hot set, interleaved with a scan over the whole segment that takes
+// the given fraction of the accesses
+class MixedGenerator : public WorkloadGenerator {
+public:
+    MixedGenerator(double theta, double scanFraction);
+    const char *getName() const override;
+    WorkloadGenerator *create(PageNum segmentSize, PageNum memoryShare, unsigned seed) const override;
+    PageNum nextPage() override;
+    ~MixedGenerator() override;
+private:
+    double theta;
+    double scanFraction;
+    std::minstd_rand random;
+    WorkloadGenerator *oltp = 0;
+    WorkloadGenerator *scan = 0;
+};
+
+
+#endif //VM_WORKLOADGENERATOR_H
@@ -1,46 +1,200 @@
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <memory>
 #include <iostream>
 #include <thread>
 #include "System.h"
+#include "Benchmark.h"
 #include "part.h"
 #include "vm_declarations.h"
 #include "ProcessTest.h"
 #include "SystemTest.h"
+#include "StressTest.h"
+#include "TestUtils.h"
+#include "TraceAnalyzer.h"
+#include "TraceReplay.h"
+#include "FeatureTest.h"
+#include "WorkloadGenerator.h"
 
 #define VM_SPACE_SIZE (100)
 #define PMT_SPACE_SIZE (3000)
 #define N_PROCESS (2)
 #define PERIODIC_JOB_COST (1)
+#define STRESS_MAX_THREADS (64)
+#define STRESS_FRAMES_PER_THREAD (32)
+#define STRESS_ACCESSES (100000)
+#define TRACE_EVENTS_PER_THREAD (1 << 20)
+#define TRACE_TIME_BUCKETS (64)
+#define TRACE_PAGE_BUCKETS (16)
+#define REPLAY_ACCESSES_PER_TICK (1000)
+#define BENCH_MAX_PROCESSES (8)
+#define BENCH_MEMORY_SCALES (4)
+#define BENCH_ACCESSES (20000)
+#define BENCH_WRITE_FRACTION (0.3)
+#define BENCH_OVERCOMMIT (2)
+// room for the pmts of half of BENCH_MAX_PROCESSES, so the sweep also shows where pmt space runs out
+#define BENCH_SMALL_PMT_SPACE (BENCH_MAX_PROCESSES / 2 * SIZE_OF_PMT_IN_PAGES)
 
-PhysicalAddress alignPointer(PhysicalAddress address) {
-    uint64_t addr = reinterpret_cast<uint64_t> (address);
+// every thread makes the same number of accesses in every run; the faults per access of the process that
+// faulted least and most show whether memory was shared out evenly. With perfect scaling the throughput grows
+// with the thread count and the efficiency, the speedup per thread, stays at one
+int runStressTest(Partition &part, unsigned maxThreads) {
+    StressTest stressTest(part, STRESS_FRAMES_PER_THREAD);
+    std::cout << "threads\taccesses/s\tfaults/s\tfaults/access\tmin process\tmax process\tspeedup\tefficiency\n";
+    double baseline = 0;
+    for (unsigned threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        StressResult result = stressTest.run(threadCount, STRESS_ACCESSES);
+        double accessesPerSecond = result.seconds > 0 ? result.accesses / result.seconds : 0;
+        double faultsPerSecond = result.seconds > 0 ? result.faults / result.seconds : 0;
+        if (!baseline) {
+            baseline = accessesPerSecond;
+        }
+        double speedup = baseline ? accessesPerSecond / baseline : 0;
+        std::cout << threadCount << "\t" << (unsigned long)accessesPerSecond << "\t" << (unsigned long)faultsPerSecond
+                  << "\t" << (result.accesses ? (double)result.faults / result.accesses : 0) << "\t" << result.minFaultRate
+                  << "\t" << result.maxFaultRate << "\t" << speedup
+                  << "\t" << speedup / threadCount << "\n";
+    }
+    std::cout << "Stress test finished with " << stressTest.getErrorCount() << " errors\n";
+    return stressTest.getErrorCount() ? 1 : 0;
+}
 
-    addr += PAGE_SIZE;
-    addr = addr / PAGE_SIZE * PAGE_SIZE;
+int runFeatureTest(Partition &part) {
+    FeatureTest featureTest(part);
+    featureTest.run();
+    std::cout << "Feature test finished with " << featureTest.getErrorCount() << " errors\n";
+    return featureTest.getErrorCount() ? 1 : 0;
+}
 
-    return reinterpret_cast<PhysicalAddress> (addr);
+int runTraceAnalyzer(const char *path) {
+    std::vector<TraceEvent> events;
+    if (!TraceAnalyzer::load(path, &events)) {
+        std::cout << "Cannot read trace " << path << "\n";
+        return 1;
+    }
+    TraceAnalyzer analyzer(events);
+    analyzer.printFaultHeatmap(std::cout, TRACE_TIME_BUCKETS, TRACE_PAGE_BUCKETS);
+    analyzer.printReuseDistances(std::cout);
+    analyzer.printTimelines(std::cout, TRACE_TIME_BUCKETS);
+    return 0;
 }
 
-int main() {
+int runTraceReplay(Partition &part, const char *path, PageNum frames) {
+    std::vector<ReplayAccess> accesses;
+    if (!TraceReplay::load(path, &accesses)) {
+        std::cout << "Cannot read trace " << path << "\n";
+        return 1;
+    }
+    TraceReplay replay(part, frames, REPLAY_ACCESSES_PER_TICK);
+    std::vector<ReplayResult> results;
+    results.push_back(replay.runSystem(accesses));
+    results.push_back(replay.simulateLRU(accesses));
+    results.push_back(replay.simulateOptimal(accesses));
+    std::cout << "Replay of " << accesses.size() << " accesses with " << frames << " frames\n";
+    TraceReplay::printResults(std::cout, results);
+    return 0;
+}
+
+// the kernel prints its own diagnostics on the way, so results are best written to a file of their own
+int runBenchmark(Partition &part, bool json, const char *path) {
+    std::ofstream file;
+    if (path) {
+        file.open(path);
+        if (!file) {
+            std::cout << "Cannot write " << path << "\n";
+            return 1;
+        }
+    }
+    std::ostream &out = path ? file : std::cout;
+
+    ZipfianGenerator zipfian(0.99);
+    SequentialGenerator sequential;
+    LoopGenerator loop(1.5);
+    PhaseGenerator phase(0.5, 5000);
+    MixedGenerator mixed(0.99, 0.2);
+    const WorkloadGenerator *workloads[] = { &zipfian, &sequential, &loop, &phase, &mixed };
+
+    Benchmark benchmark(part);
+    std::vector<BenchmarkResult> results;
+    if (!json) {
+        Benchmark::printCsvHeader(out);
+    }
+    const PageNum pmtSpaceSizes[] = { BENCH_SMALL_PMT_SPACE, PMT_SPACE_SIZE };
+    for (auto workload : workloads) {
+        for (unsigned processCount = 1; processCount <= BENCH_MAX_PROCESSES; processCount *= 2) {
+            for (PageNum memorySize = VM_SPACE_SIZE; memorySize <= VM_SPACE_SIZE * BENCH_MEMORY_SCALES; memorySize *= BENCH_MEMORY_SCALES) {
+                for (auto pmtSpaceSize : pmtSpaceSizes) {
+                    BenchmarkConfig config = { processCount, memorySize, pmtSpaceSize, BENCH_OVERCOMMIT, BENCH_ACCESSES, BENCH_WRITE_FRACTION };
+                    BenchmarkResult result = benchmark.run(*workload, config);
+                    if (!result.accesses) {
+                        // kept apart from the results, which may be going to std::cout as well
+                        std::cerr << "Skipped " << workload->getName() << " with " << processCount << " processes, "
+                                  << memorySize << " frames and " << pmtSpaceSize << " pages of pmt space, which do not fit\n";
+                        continue;
+                    }
+                    if (json) {
+                        results.push_back(result);
+                    } else {
+                        Benchmark::printCsv(out, result);
+                    }
+                }
+            }
+        }
+    }
+    if (json) {
+        Benchmark::printJson(out, results);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
     Partition part("p1.ini");
 
+    if ((argc > 1) && !strcmp(argv[1], "stress")) {
+        return runStressTest(part, (argc > 2) ? strtoul(argv[2], 0, 10) : STRESS_MAX_THREADS);
+    }
+    if ((argc > 1) && !strcmp(argv[1], "features")) {
+        return runFeatureTest(part);
+    }
+    if ((argc > 1) && !strcmp(argv[1], "bench")) {
+        return runBenchmark(part, (argc > 2) && !strcmp(argv[2], "json"), (argc > 3) ? argv[3] : 0);
+    }
+    if ((argc > 2) && !strcmp(argv[1], "analyze")) {
+        return runTraceAnalyzer(argv[2]);
+    }
+    if ((argc > 2) && !strcmp(argv[1], "replay")) {
+        PageNum frames = VM_SPACE_SIZE;
+        if (argc > 3) {
+            char *end;
+            frames = strtoul(argv[3], &end, 10);
+            if (!frames || *end) {
+                std::cerr << "Bad frame count " << argv[3] << "\n";
+                return 1;
+            }
+        }
+        return runTraceReplay(part, argv[2], frames);
+    }
+    // the usual run, recording a trace of it for analyze
+    const char *tracePath = ((argc > 2) && !strcmp(argv[1], "trace")) ? argv[2] : 0;
+
     uint64_t size = (VM_SPACE_SIZE + 2) * PAGE_SIZE;
     PhysicalAddress vmSpace = (PhysicalAddress ) new char[size];
-    PhysicalAddress alignedVmSpace = alignPointer(vmSpace);
+    PhysicalAddress alignedVmSpace = alignToPage(vmSpace);
 
     size = (PMT_SPACE_SIZE + 2) * PAGE_SIZE;
     PhysicalAddress pmtSpace = (PhysicalAddress ) new char[size];
-    PhysicalAddress alignedPmtSpace = alignPointer(pmtSpace);
+    PhysicalAddress alignedPmtSpace = alignToPage(pmtSpace);
 
     System system(alignedVmSpace, VM_SPACE_SIZE, alignedPmtSpace, PMT_SPACE_SIZE, &part);
     SystemTest systemTest(system, alignedVmSpace, VM_SPACE_SIZE);
+    if (tracePath) {
+        system.startTrace(TRACE_EVENTS_PER_THREAD);
+    }
     ProcessTest* process[N_PROCESS];
     std::thread *threads[N_PROCESS];
 
-    std::mutex globalMutex;
-
     for (int i = 0; i < N_PROCESS; i++) {
 		process[i] = new ProcessTest(system, systemTest);
     }
@@ -54,8 +208,6 @@ int main() {
     while ((time = system.periodicJob())) {
         std::this_thread::sleep_for(std::chrono::microseconds(time));
 
-        std::lock_guard<std::mutex> guard(systemTest.getGlobalMutex());
-
         std::cout << "Doing periodic job\n";
 
         std::this_thread::sleep_for(std::chrono::microseconds(PERIODIC_JOB_COST));
@@ -76,6 +228,13 @@ int main() {
         delete process[i];
     }
 
+    if (tracePath && (system.writeTrace(tracePath) != OK)) {
+        std::cout << "Cannot write trace " << tracePath << "\n";
+    }
+
+    std::vector<Time> tickHistory = system.getTickHistory();
+    ReclaimStats reclaimStats = system.getReclaimStats();
+
     delete [] vmSpace;
     delete [] pmtSpace;
 
@@ -83,5 +242,16 @@ int main() {
 	if (systemTest.missCount + systemTest.hitCount) {
 		std::cout << "Hit rate: " << ((double)systemTest.hitCount) / (systemTest.hitCount + systemTest.missCount) << "\n";
 	}
+	if (reclaimStats.faults) {
+		std::cout << "Direct reclaims: " << reclaimStats.directReclaims << " of " << reclaimStats.faults << " faults ("
+			<< reclaimStats.backgroundReclaims << " pages reclaimed in the background)\n";
+	}
+	if (!tickHistory.empty()) {
+		std::cout << "Last ticks:";
+		for (auto t = tickHistory.size() > 16 ? tickHistory.end() - 16 : tickHistory.begin(); t != tickHistory.end(); t++) {
+			std::cout << " " << *t;
+		}
+		std::cout << "\n";
+	}
 	std::cin.get();
 }
\ No newline at end of file
@@ -1,9 +1,21 @@
 #pragma once
 
+#include <cstdint>
 #include <set>
 #include <map>
+#include <vector>
 #include "part.h"
 
+// latencies are kept in histograms of this many power-of-two buckets, the last one reaching past a second
+#define LATENCY_BUCKETS 22
+// set to 1 to have every lock the kernel takes counted and timed per call site, see LockProfiler.h;
+// left at 0 the locks are the plain standard ones
+#ifndef LOCK_PROFILING
+#define LOCK_PROFILING 0
+#endif
+// counters are split into this many stripes so that threads counting at once rarely touch the same cache line
+#define STAT_STRIPES 8
+
 typedef unsigned long PageNum;
 typedef unsigned long VirtualAddress;
 typedef void* PhysicalAddress;
@@ -17,6 +29,8 @@ typedef std::set<PhysicalAddress> PmtPool;
 
 enum Status { OK, PAGE_FAULT, TRAP };
 enum AccessType { READ = 1, WRITE, READ_WRITE, EXECUTE };
+// NORMAL, SEQUENTIAL and RANDOM stick to the segments, WILLNEED and DONTNEED act on the pages right away
+enum Advice { ADVICE_NORMAL, ADVICE_SEQUENTIAL, ADVICE_RANDOM, ADVICE_WILLNEED, ADVICE_DONTNEED };
 enum PTEMask { MASK_MAPPED = 0x200, MASK_LRU_DIRTY = 0x1f8, MASK_LRU = 0x1f0, MASK_ACCESSED = 0x100, MASK_ADD_BITS = 0x0f0, MASK_DIRTY = 0x008, MASK_FLAGS = 0x007 };
 
 typedef struct RootClusterEntry {
@@ -41,16 +55,137 @@ typedef struct PEPC {
 	ClusterNo pageCluster;
 } PEPC;
 
+struct SharedSegment;
+
 typedef struct Segment {
 	VirtualAddress startAddress;
 	PageNum size;
 	PageNum physicalSize;
+	Advice advice;
+	AccessType flags;
+	// locked segments have all their pages pinned in memory
+	bool locked;
+	// set when the pages belong to a shared segment rather than to the process
+	SharedSegment* shared;
+	// lazily loaded segments fault their pages in from here until they are written out, the caller keeps it alive
+	const char* content;
+	// pages past this many have nothing in the content, they start out zeroed
+	PageNum contentSize;
+	// pages below this many that were never faulted on have their contents in the partition, put there by loadSegment
+	PageNum preloadedSize;
+	// pages whose entries have been written, the rest are as the segment says; only these need visiting when it goes
+	std::set<PageNum> materialized;
 
 	const bool operator< (const Segment& other) const {
 		return startAddress < other.startAddress;
 	}
 } Segment;
 
+typedef struct PeriodicJobConfig {
+	Time minTick;
+	Time maxTick;
+	// faults per second under memory pressure above which the tick gets shorter
+	double targetFaultRate;
+	// fraction of frames in use above which memory counts as under pressure
+	double pressureThreshold;
+} PeriodicJobConfig;
+
+typedef struct ReclaimStats {
+	unsigned long faults;
+	// faults which found no free frame and had to evict a page themselves
+	unsigned long directReclaims;
+	// pages evicted by the background reclaimer
+	unsigned long backgroundReclaims;
+} ReclaimStats;
+
+typedef struct LatencyHistogram {
+	unsigned long count;
+	unsigned long totalMicroseconds;
+	// bucket i counts the latencies below 2^i microseconds that did not fit in the one before, the last takes the rest
+	unsigned long buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+typedef struct ProcessStats {
+	// accesses that found the page resident
+	unsigned long hits;
+	// faults served without reading the partition, from the segment's content, zeros, a copy or another mapping
+	unsigned long minorFaults;
+	// faults that had to read the page from the partition
+	unsigned long majorFaults;
+	unsigned long cleanEvictions;
+	unsigned long dirtyEvictions;
+	// pages read ahead of a fault in a sequentially advised segment
+	unsigned long prefetchedPages;
+	// prefetched pages that were accessed before they were evicted
+	unsigned long prefetchHits;
+	LatencyHistogram faultLatency;
+} ProcessStats;
+
+typedef struct SystemStats {
+	// summed over the live processes and those that have already gone
+	ProcessStats processes;
+	unsigned long clusterReads;
+	unsigned long clusterWrites;
+	unsigned long buddySplits;
+	unsigned long buddyMerges;
+	unsigned long agingTicks;
+	LatencyHistogram agingTickLatency;
+	LatencyHistogram partitionReadLatency;
+	LatencyHistogram partitionWriteLatency;
+} SystemStats;
+
+enum TraceEventType { TRACE_ACCESS, TRACE_FAULT, TRACE_EVICTION, TRACE_WRITE_BACK, TRACE_SEGMENT_CREATE, TRACE_SEGMENT_DELETE, TRACE_TICK };
+
+// Fixed layout, traces are written to files as arrays of these
+typedef struct TraceEvent {
+	// nanoseconds since the trace was started
+	uint64_t timestamp;
+	// virtual page number, the first page for segment events
+	uint64_t page;
+	// physical frame number the page was in or got, zero if there was none
+	uint64_t frame;
+	uint32_t pid;
+	// pages of the segment for segment events, the tick length returned for ticks
+	uint32_t count;
+	uint8_t type;
+	// the AccessType and Status of accesses
+	uint8_t accessType;
+	uint8_t status;
+	uint8_t reserved[5];
+} TraceEvent;
+
+typedef struct TraceFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t eventSize;
+	uint64_t eventCount;
+} TraceFileHeader;
+
+typedef struct SharedPage {
+	// the frame stays as long as some process maps it, the contents go to the cluster once the last one lets go
+	PhysicalAddress frame;
+	ClusterNo cluster;
+	unsigned mappings;
+	bool dirty;
+} SharedPage;
+
+typedef struct SharedMapping {
+	SharedSegment* segment;
+	PageNum page;
+	bool dirty;
+} SharedMapping;
+
+typedef struct AccessRequest {
+	VirtualAddress address;
+	AccessType type;
+} AccessRequest;
+
+typedef struct AccessResult {
+	Status status;
+	// only valid when status is OK
+	PhysicalAddress physicalAddress;
+} AccessResult;
+
 typedef struct PTE {
 	pte_t frame;
 	bool mapped;
@@ -58,6 +193,12 @@ typedef struct PTE {
 	uint8_t addBits;
 	bool dirty;
 	AccessType flags;
+	uint16_t epoch;
+	bool pinned;
+	bool copyOnWrite;
+	bool shared;
+	bool swapped;
+	bool prefetched;
 } PTE;
 
 #define PAGE_OFFSET_LENGTH 10
@@ -68,7 +209,56 @@ typedef struct PTE {
 #define SIZE_OF_PMT_IN_PAGES ((PMT_SIZE * sizeof(pte_t) - 1) / PAGE_SIZE + 1)
 
 #define PTE_FRAME_SHIFT 10
+#define PTE_FRAME_MASK ((1ULL << 37) - 1)
 #define PTE_ADD_BITS_SHIFT 4
+// epoch at which the aging bits of the entry were last brought up to date, modulo PTE_EPOCH_MASK + 1
+#define PTE_EPOCH_SHIFT 52
+#define PTE_EPOCH_MASK 0xfffULL
+// the page was brought in by readahead and has not been accessed since, the first access counts a prefetch hit
+#define MASK_PREFETCHED (1ULL << 47)
+// pinned pages are never chosen for eviction
+#define MASK_PINNED (1ULL << 48)
+// the frame may be shared with a clone, writing to it takes a fault which gives the page a frame of its own
+#define MASK_COW (1ULL << 49)
+// the page belongs to a shared segment, its frame and contents are kept in the segment's SharedPage
+#define MASK_SHARED (1ULL << 50)
+// the contents of the page are in the partition, otherwise a fault fills it from the segment's content, or with zeros
+#define MASK_SWAPPED (1ULL << 51)
+
+// every entry is aged at least this often, so that the truncated epoch in the pte cannot wrap around;
+// the periodic job ages this many entries of every process per tick to get around the whole pmt in time
+#define AGING_SWEEP_PERIOD ((PTE_EPOCH_MASK + 1) / 2)
+#define AGING_SWEEP_BATCH ((PMT_SIZE - 1) / AGING_SWEEP_PERIOD + 1)
+
+// how many pmt entries the pre-cleaner looks at per process per tick, and how many of them it may write back
+#define PRECLEAN_SCAN_LENGTH 1024
+#define PRECLEAN_BATCH 8
+#define COMPACTION_PERIOD 16
+// events kept per thread by a trace that is not told otherwise, older ones are overwritten
+#define TRACE_DEFAULT_CAPACITY (1 << 16)
+#define TRACE_MAGIC "OS2TRACE"
+#define TRACE_VERSION 1
+// how many pages one eviction takes out at a time
+#define EVICTION_BATCH 8
+// a fault in a sequentially advised segment brings in this many pages after it as well, and ages out
+// the ones more than this far behind it
+#define READAHEAD_WINDOW 8
+// a range fault takes at most this fraction of memory at a time, so it cannot hold on to all of it
+#define FAULT_CHUNK_DIVISOR 4
+// a process may pin this fraction of memory unless told otherwise, and all of them together at most half of it
+#define DEFAULT_PIN_QUOTA_DIVISOR 8
+#define MAX_PINNED_DIVISOR 2
+
+#define DEFAULT_TICK 1000
+#define DEFAULT_MIN_TICK 250
+#define DEFAULT_MAX_TICK 16000
+#define DEFAULT_TARGET_FAULT_RATE 2000.0
+#define DEFAULT_PRESSURE_THRESHOLD 0.8
+#define TICK_HISTORY_LENGTH 256
+
+// default free frame watermarks of the background reclaimer, as fractions of physical memory
+#define DEFAULT_LOW_WATERMARK_DIVISOR 16
+#define DEFAULT_HIGH_WATERMARK_DIVISOR 8
 
 #define ROOT_CLUSTER_ENTRIES (ClusterSize / sizeof(RootClusterEntry))
 #define PROCESS_CLUSTER_ENTRIES (ClusterSize / sizeof(ProcessClusterEntry))